@@ -9,10 +9,10 @@ void testApp::setup(){
 	
 	bvh.resize(3);
 	
-	// setup bvh
-	bvh[0].load("A_test.bvh");
-	bvh[1].load("B_test.bvh");
-	bvh[2].load("C_test.bvh");
+	// setup bvh, loads in the background
+	loader.add(bvh[0], "A_test.bvh");
+	loader.add(bvh[1], "B_test.bvh");
+	loader.add(bvh[2], "C_test.bvh");
 	
 	for (int i = 0; i < bvh.size(); i++)
 	{
@@ -44,7 +44,12 @@ void testApp::draw(){
 	}
 	
 	cam.end();
-
+	
+	if (!loader.isDone())
+	{
+		ofSetColor(255);
+		ofDrawBitmapString("loading " + ofToString(loader.getProgress() * 100, 0) + "%", 10, 20);
+	}
 }
 
 //--------------------------------------------------------------
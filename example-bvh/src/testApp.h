@@ -2,6 +2,7 @@
 
 #include "ofMain.h"
 #include "ofxBvh.h"
+#include "ofxBvhLoader.h"
 
 class testApp : public ofBaseApp{
 
@@ -21,6 +22,7 @@ class testApp : public ofBaseApp{
 	void gotMessage(ofMessage msg);
 	
 	vector<ofxBvh> bvh;
+	ofxBvhLoader loader;
 	ofEasyCam cam;
 	
 };
@@ -212,14 +212,17 @@ void testApp::setup()
 
 	ofBackground(255);
 	
-	bvh.resize(3);
+	for (int i = 0; i < 3; i++)
+		bvh.add();
 	
 	// You have to get motion and sound data from http://www.perfume-global.com
 	
 	// setup bvh
-	bvh[0].load("bvhfiles/aachan.bvh");
-	bvh[1].load("bvhfiles/kashiyuka.bvh");
-	bvh[2].load("bvhfiles/nocchi.bvh");
+	ofxBvhLoader loader;
+	loader.add(bvh[0], "bvhfiles/aachan.bvh");
+	loader.add(bvh[1], "bvhfiles/kashiyuka.bvh");
+	loader.add(bvh[2], "bvhfiles/nocchi.bvh");
+	loader.waitForAll();
 	
 	for (int i = 0; i < bvh.size(); i++)
 	{
@@ -230,6 +233,8 @@ void testApp::setup()
 	track.setLoop(true);
 	track.play();
 	
+	bvh.setClock(&clock);
+	
 	// setup tracker
 	for (int i = 0; i < bvh.size(); i++)
 	{
@@ -253,16 +258,15 @@ void testApp::setup()
 //--------------------------------------------------------------
 void testApp::update()
 {
-	float t = (track.getPosition() * trackDuration);
-	t = t / bvh[0].getDuration();
+	clock.addObservation(track.getPosition() * trackDuration);
+	clock.update();
 	
 	center_t.set(0, 0, 0);
 	
+	bvh.update();
+	
 	for (int i = 0; i < bvh.size(); i++)
 	{
-		bvh[i].setPosition(t);
-		bvh[i].update();
-		
 		center_t += bvh[i].getJoint(0)->getPosition();
 	}
 	
@@ -61,24 +61,34 @@ void testApp::setup()
 	play_rate = play_rate_t = 1;
 	rotate = 0;
 
-	bvh.resize(3);
+	for (int i = 0; i < 3; i++)
+		bvh.add();
 	
 	// You have to get motion and sound data from http://www.perfume-global.com
 	
 	// setup bvh
-	bvh[0].load("bvhfiles/aachan.bvh");
-	bvh[1].load("bvhfiles/kashiyuka.bvh");
-	bvh[2].load("bvhfiles/nocchi.bvh");
+	ofxBvhLoader loader;
+	loader.add(bvh[0], "bvhfiles/aachan.bvh");
+	loader.add(bvh[1], "bvhfiles/kashiyuka.bvh");
+	loader.add(bvh[2], "bvhfiles/nocchi.bvh");
+	loader.waitForAll();
 	
 	for (int i = 0; i < bvh.size(); i++)
 	{
 		bvh[i].setFrame(1);
+		
+		// scratching jumps all over the take, so every frame's pose is
+		// baked once and looked up after that
+		bvh[i].bake();
 	}
 	
 	track.loadSound("Perfume_globalsite_sound.wav");
 	track.play();
 	track.setLoop(true);
 	
+	// motion follows the sound rather than the frame rate
+	bvh.setClock(&clock);
+	
 	// setup tracker
 	for (int i = 0; i < bvh.size(); i++)
 	{
@@ -102,14 +112,12 @@ void testApp::update()
 	play_rate += (play_rate_t - play_rate) * 0.3;
 	track.setSpeed(play_rate);
 	
-	float t = (track.getPosition() * trackDuration);
-	t = t / bvh[0].getDuration();
+	clock.setSpeed(play_rate);
+	clock.addObservation(track.getPosition() * trackDuration);
+	clock.update();
 	
-	for (int i = 0; i < bvh.size(); i++)
-	{
-		bvh[i].setPosition(t);
-		bvh[i].update();
-	}
+	// all performers at once, spread over the worker pool
+	bvh.update();
 	
 	for (int i = 0; i < trackers.size(); i++)
 	{
@@ -145,10 +153,7 @@ void testApp::draw(){
 		ofPopMatrix();
 		
 		// draw actor
-		for (int i = 0; i < bvh.size(); i++)
-		{
-			bvh[i].draw();
-		}
+		bvh.draw();
 
 		// draw tracker
 		glDisable(GL_DEPTH_TEST);
@@ -2,6 +2,8 @@
 
 #include "ofMain.h"
 #include "ofxBvh.h"
+#include "ofxBvhLoader.h"
+#include "ofxBvhGroup.h"
 
 class testApp : public ofBaseApp{
 
@@ -21,7 +23,8 @@ class testApp : public ofBaseApp{
 	void gotMessage(ofMessage msg);
 	
 	ofSoundPlayer track;
-	vector<ofxBvh> bvh;
+	ofxBvhAudioClock clock;
+	ofxBvhGroup bvh;
 	
 	float rotate;
 	
@@ -9,14 +9,20 @@ void testApp::setup() {
 	
 	rotate = 0;
 	
-	bvh[0].load("bvhfiles/kashiyuka.bvh");
-	bvh[1].load("bvhfiles/nocchi.bvh");
-	bvh[2].load("bvhfiles/aachan.bvh");
+	ofxBvhLoader loader;
+	loader.add(bvh[0], "bvhfiles/kashiyuka.bvh");
+	loader.add(bvh[1], "bvhfiles/nocchi.bvh");
+	loader.add(bvh[2], "bvhfiles/aachan.bvh");
+	loader.waitForAll();
 	
 	for (int i = 0; i < 3; i++)	{
 		bvh[i].play();
+		bvh[i].setLoop(true);
+		stepper.add(bvh[i]);
 	}
 	
+	stepper.addListener(this);
+	
 	track.loadSound("Perfume_globalsite_sound.wav");
 	track.play();
 	track.setLoop(true);
@@ -56,16 +62,30 @@ void testApp::setup() {
 
 //--------------------------------------------------------------
 void testApp::update(){
-	float t = (track.getPosition() * 64.28);
-	t = t / bvh[0].getDuration();
+	// the metaballs follow the joints by 1/60 s steps of the song
+	stepper.updateTo(track.getPosition() * 64.28);
 	
-	for (int i = 0; i < 3; i++)	{
-		bvh[i].setPosition(t);
-		bvh[i].update();
-	}
+	float t = stepper.getTime() / bvh[0].getDuration();
 	
 	marchingCubes.resetIsoValues();
 	
+	int n = 0;
+	for (int i = 0; i < 3; i++){
+		for (int j = 0; j < bvh[i].getNumJoints(); j++) {
+			if (t > startTime && bvh[i].getJoint(j)->isSite()) {
+				marchingCubes.addMetaBall(metaBalls[n], metaBalls[n].size);
+			}
+			n++;
+		}
+	}
+	
+	marchingCubes.update(0.17, true);
+}
+
+//--------------------------------------------------------------
+void testApp::step(float time, float dt){
+	float t = time / bvh[0].getDuration();
+	
 	int n = 0;
 	for (int i = 0; i < 3; i++){
 		for (int j = 0; j < bvh[i].getNumJoints(); j++) {
@@ -73,7 +93,6 @@ void testApp::update(){
 			if (o->isSite()) {
 				if (t > startTime) {
 					metaBalls[n].goTo(o->getPosition(), 0.3, 0.94);
-					marchingCubes.addMetaBall(metaBalls[n], metaBalls[n].size);
 				} else {
 					metaBalls[n].goTo(o->getPosition(), 1.0, 0.1);
 				}
@@ -81,8 +100,6 @@ void testApp::update(){
 			n++;
 		}
 	}
-	
-	marchingCubes.update(0.17, true);
 }
 
 //--------------------------------------------------------------
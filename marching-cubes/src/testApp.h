@@ -3,11 +3,13 @@
 #include "ofMain.h"
 
 #include "ofxBvh.h"
+#include "ofxBvhLoader.h"
+#include "ofxBvhStepper.h"
 #include "ofxSTL.h"
 #include "ofxMarchingCubes.h"
 #include "MetaBall.h"
 
-class testApp : public ofBaseApp{
+class testApp : public ofBaseApp, public ofxBvhStepper::Listener{
 
   public:
 	void setup();
@@ -24,9 +26,12 @@ class testApp : public ofBaseApp{
 	void windowResized(int w, int h);
 	void dragEvent(ofDragInfo dragInfo);
 	void gotMessage(ofMessage msg);
+	
+	void step(float time, float dt);
 		
 	ofSoundPlayer track;
 	ofxBvh bvh[3];
+	ofxBvhStepper stepper;
 	
 	float rotate;
 	float play_rate, play_rate_t;
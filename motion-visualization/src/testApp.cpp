@@ -64,14 +64,20 @@ void testApp::setup() {
 	rotate = 0;
 	
 	// setup bvh
-	bvh[0].load("bvhfiles/kashiyuka.bvh");
-	bvh[1].load("bvhfiles/nocchi.bvh");
-	bvh[2].load("bvhfiles/aachan.bvh");
+	ofxBvhLoader loader;
+	loader.add(bvh[0], "bvhfiles/kashiyuka.bvh");
+	loader.add(bvh[1], "bvhfiles/nocchi.bvh");
+	loader.add(bvh[2], "bvhfiles/aachan.bvh");
+	loader.waitForAll();
 	
 	for (int i = 0; i < 3; i++)	{
 		bvh[i].play();
+		bvh[i].setLoop(true);
+		stepper.add(bvh[i]);
 	}
 	
+	stepper.addListener(this);
+	
 	track.loadSound("Perfume_globalsite_sound.wav");
 	track.play();
 	track.setLoop(true);
@@ -103,13 +109,14 @@ void testApp::update()
 {
 	rotate += 0.04;
 	
-	float t = (track.getPosition() * 64.28);
-	t = t / bvh[0].getDuration();
-	
-	for (int i = 0; i < 3; i++)	{
-		bvh[i].setPosition(t);
-		bvh[i].update();
-	}
+	// the trails grow by 1/60 s steps of the song, not by frames
+	stepper.updateTo(track.getPosition() * 64.28);
+}
+
+//--------------------------------------------------------------
+void testApp::step(float time, float dt)
+{
+	float t = time / bvh[0].getDuration();
 	
 	for (int i = 0; i < trackers.size(); i++) {
 		if (t > startTime) {
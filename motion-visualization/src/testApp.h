@@ -2,8 +2,10 @@
 
 #include "ofMain.h"
 #include "ofxBvh.h"
+#include "ofxBvhLoader.h"
+#include "ofxBvhStepper.h"
 
-class testApp : public ofBaseApp{
+class testApp : public ofBaseApp, public ofxBvhStepper::Listener{
 
   public:
 	void setup();
@@ -20,9 +22,12 @@ class testApp : public ofBaseApp{
 	void windowResized(int w, int h);
 	void dragEvent(ofDragInfo dragInfo);
 	void gotMessage(ofMessage msg);
+	
+	void step(float time, float dt);
 		
 	ofSoundPlayer track;
 	ofxBvh bvh[3];
+	ofxBvhStepper stepper;
 	
 	float rotate;
 	float play_rate, play_rate_t;
@@ -1,426 +1,2471 @@
 #include "ofxBvh.h"
 
+#include "Poco/Environment.h"
+#include "Poco/File.h"
+#include "Poco/Process.h"
+#include "Poco/SharedMemory.h"
+#include "Poco/Thread.h"
+
+// .bvhc layout: CacheHeader, joint records, then num_frames * total_channels
+// floats starting at frames_offset. everything is stored in native byte order.
+static const char CACHE_MAGIC[4] = { 'B', 'V', 'H', 'C' };
+static const unsigned int CACHE_VERSION = 1;
+static const unsigned int CACHE_BYTE_ORDER = 0x01020304;
+
+struct CacheHeader
+{
+	char magic[4];
+	unsigned int version;
+	unsigned int byte_order;
+	unsigned int frames_offset;
+	
+	long long source_size;
+	long long source_modified;
+	
+	int num_joints;
+	int total_channels;
+	int num_frames;
+	float frame_time;
+};
+
 static inline void billboard();
 
-ofxBvh::~ofxBvh()
+// text scanning helpers, all bounded by an explicit end pointer so they
+// work on memory mapped files that are not null terminated
+
+static inline bool isBlank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+static inline const char* findString(const char *begin, const char *end, const char *str)
+{
+	return std::search(begin, end, str, str + strlen(str));
+}
+
+static inline const char* nextLine(const char *p, const char *end)
+{
+	const char *e = (const char*)memchr(p, '\n', end - p);
+	return e ? e : end;
+}
+
+static inline const char* skipNewline(const char *p, const char *end)
+{
+	return p < end ? p + 1 : end;
+}
+
+static inline void trimLine(const char *&begin, const char *&end)
+{
+	while (begin < end && isBlank(*begin)) begin++;
+	while (end > begin && isBlank(end[-1])) end--;
+}
+
+// parses a decimal float starting at p, returns the end of the token.
+// plain "-123.456789" style values are converted exactly with integer
+// arithmetic; anything unusual goes through strtof so the result always
+// matches the sscanf("%f") the loader used to run per channel.
+static const char* parseFloat(const char *p, const char *end, float &out)
+{
+	static const double POW10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	
+	while (p < end && isBlank(*p)) p++;
+	
+	const char *begin = p;
+	
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+	
+	unsigned long long mantissa = 0;
+	int num_digits = 0;
+	int num_decimals = 0;
+	
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		mantissa = mantissa * 10 + (*p++ - '0');
+		num_digits++;
+	}
+	
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			mantissa = mantissa * 10 + (*p++ - '0');
+			num_digits++;
+			num_decimals++;
+		}
+	}
+	
+	bool exact = num_digits > 0 && num_digits <= 15 && (p == end || isBlank(*p));
+	
+	if (exact)
+	{
+		// both operands are exact doubles so the quotient is correctly rounded,
+		// only a result sitting exactly between two floats can round differently
+		double v = (double)mantissa / POW10[num_decimals];
+		float f = (float)v;
+		
+		if ((double)f != v)
+		{
+			float g = nextafterf(f, (double)f < v ? FLT_MAX : -FLT_MAX);
+			if (((double)f + (double)g) * 0.5 == v)
+				exact = false;
+		}
+		
+		if (exact)
+		{
+			out = negative ? -f : f;
+			return p;
+		}
+	}
+	
+	while (p < end && !isBlank(*p)) p++;
+	
+	char buf[64];
+	size_t len = std::min<size_t>(p - begin, sizeof(buf) - 1);
+	memcpy(buf, begin, len);
+	buf[len] = '\0';
+	
+	out = strtof(buf, NULL);
+	return p;
+}
+
+// parses whitespace separated values into dst, returns the number of
+// values found on the line even if it exceeds the capacity
+static int parseFrame(const char *p, const char *end, float *dst, int capacity)
+{
+	int count = 0;
+	float dummy;
+	
+	while (true)
+	{
+		while (p < end && isBlank(*p)) p++;
+		if (p == end) break;
+		
+		p = parseFloat(p, end, count < capacity ? dst[count] : dummy);
+		count++;
+	}
+	
+	return count;
+}
+
+// finds the next non-blank line at or after p and advances p past it
+static bool nextFrameLine(const char *&p, const char *end, const char *&line, const char *&line_end)
+{
+	while (p < end)
+	{
+		line = p;
+		line_end = nextLine(p, end);
+		p = skipNewline(line_end, end);
+		
+		trimLine(line, line_end);
+		if (line != line_end) return true;
+	}
+	
+	return false;
+}
+
+static bool parseFrameData(const char *line, const char *line_end, float *data, int total_channels)
+{
+	return parseFrame(line, line_end, data, total_channels) == total_channels;
+}
+
+// one line aligned slice of the MOTION section. the first pass counts the
+// frame lines in it, the second parses them into their preallocated slots.
+struct MotionRange : public Poco::Runnable
+{
+	const char *begin;
+	const char *end;
+	
+	float *frames;
+	int frame_stride;
+	int total_channels;
+	
+	bool counting;
+	int num_lines;
+	int error_line;
+	
+	MotionRange() : begin(NULL), end(NULL), frames(NULL), frame_stride(0), total_channels(0),
+		counting(true), num_lines(0), error_line(-1) {}
+	
+	void run()
+	{
+		const char *p = begin;
+		const char *line, *line_end;
+		
+		if (counting)
+		{
+			num_lines = 0;
+			while (nextFrameLine(p, end, line, line_end))
+				num_lines++;
+			
+			return;
+		}
+		
+		for (int i = 0; i < num_lines && nextFrameLine(p, end, line, line_end); i++)
+		{
+			if (!parseFrameData(line, line_end, frames + (size_t)i * frame_stride, total_channels))
+			{
+				error_line = i;
+				return;
+			}
+		}
+	}
+};
+
+// runs every range, the last one on the calling thread
+static void runRanges(vector<MotionRange>& ranges)
+{
+	vector<Poco::Thread*> threads;
+	
+	for (int i = 0; i < (int)ranges.size() - 1; i++)
+	{
+		threads.push_back(new Poco::Thread);
+		threads.back()->start(ranges[i]);
+	}
+	
+	ranges.back().run();
+	
+	for (int i = 0; i < threads.size(); i++)
+	{
+		threads[i]->join();
+		delete threads[i];
+	}
+}
+
+struct ofxBvh::Tokenizer
+{
+	const char *p;
+	const char *end;
+	
+	const char *token;
+	size_t length;
+	
+	Tokenizer(const char *begin, const char *end) : p(begin), end(end), token(begin), length(0) {}
+	
+	bool next()
+	{
+		while (p < end && isBlank(*p)) p++;
+		
+		token = p;
+		while (p < end && !isBlank(*p)) p++;
+		length = p - token;
+		
+		return length > 0;
+	}
+	
+	bool is(const char *str) const
+	{
+		return strlen(str) == length && memcmp(token, str, length) == 0;
+	}
+	
+	char at(size_t i) const { return i < length ? token[i] : '\0'; }
+	string str() const { return string(token, length); }
+	
+	float nextFloat()
+	{
+		float v = 0;
+		if (next()) parseFloat(token, token + length, v);
+		return v;
+	}
+	
+	int nextInt()
+	{
+		return next() ? strtol(str().c_str(), NULL, 10) : 0;
+	}
+};
+
+// owns the bytes a MotionLoader is still reading from
+struct ofxBvh::MotionSource
+{
+	ofPtr<Poco::SharedMemory> mapping;
+	ofBuffer buffer;
+	
+	const char *begin;
+	const char *end;
+	
+	MotionSource() : begin(NULL), end(NULL) {}
+};
+
+// parses the remaining frame lines of a progressive load into the
+// preallocated frame slots and publishes them in chunks
+class ofxBvh::MotionLoader : public ofThread
+{
+public:
+	
+	static const int CHUNK_FRAMES = 64;
+	
+	MotionLoader(ofxBvh *bvh, ofPtr<MotionSource> source, const char *p, int num_loaded)
+		: bvh(bvh), source(source), p(p), num_loaded(num_loaded), done(false) {}
+	
+	ofxBvh *bvh;
+	ofPtr<MotionSource> source;
+	const char *p;
+	
+	// guarded by lock()
+	int num_loaded;
+	bool done;
+	
+protected:
+	
+	void threadedFunction()
+	{
+		const char *line, *line_end;
+		
+		const int capacity = bvh->getNumStoredFrames();
+		int index = num_loaded;
+		bool mismatch = false;
+		
+		while (isThreadRunning() && index < capacity)
+		{
+			int chunk_end = std::min(index + CHUNK_FRAMES, capacity);
+			
+			while (index < chunk_end && nextFrameLine(p, source->end, line, line_end))
+			{
+				if (!parseFrameData(line, line_end, bvh->getFrameData(index), bvh->total_channels))
+				{
+					ofLogError("ofxBvh", "channel size mismatch");
+					mismatch = true;
+					break;
+				}
+				
+				index++;
+			}
+			
+			lock();
+			num_loaded = index;
+			unlock();
+			
+			if (mismatch || index < chunk_end) break;
+		}
+		
+		if (!mismatch && isThreadRunning())
+		{
+			// lines beyond the Frames: count have no slot to go into
+			if (index < capacity || nextFrameLine(p, source->end, line, line_end))
+				ofLogWarning("ofxBvh", "frame size mismatch");
+			
+			if (bvh->cache_enabled && !bvh->writeCache(index))
+				ofLogVerbose("ofxBvh", "can't write motion cache for " + bvh->source_path);
+		}
+		
+		lock();
+		done = true;
+		unlock();
+	}
+};
+
+class ofxBvh::LoadJob : public ofxBvhWorkerPool::Task
+{
+public:
+	
+	ofxBvh bvh;
+	string path;
+	
+protected:
+	
+	void run()
+	{
+		bvh.load(path);
+	}
+};
+
+class ofxBvh::BakeJob : public ofxBvhWorkerPool::Task
+{
+public:
+	
+	ofxBvh *bvh;
+	int num_frames;
+	int num_joints;
+	
+	// num_joints global transforms per frame, frame after frame
+	vector<ofQuaternion> rotations;
+	vector<ofVec3f> positions;
+	
+	BakeJob() : bvh(NULL), num_frames(0), num_joints(0), num_baked(0), cancelled(false) {}
+	
+	int getNumBaked()
+	{
+		ofMutex::ScopedLock lock(mutex);
+		return num_baked;
+	}
+	
+	void cancel()
+	{
+		ofMutex::ScopedLock lock(mutex);
+		cancelled = true;
+	}
+	
+protected:
+	
+	ofMutex mutex;
+	int num_baked;
+	bool cancelled;
+	
+	void run()
+	{
+		rotations.resize((size_t)num_frames * num_joints);
+		positions.resize((size_t)num_frames * num_joints);
+		FrameBuffer frame(bvh->frame_stride, 0);
+		
+		for (int i = 0; i < num_frames; i++)
+		{
+			const size_t first = (size_t)i * num_joints;
+			bvh->computeGlobals(i, &frame[0], &rotations[first], &positions[first]);
+			
+			ofMutex::ScopedLock lock(mutex);
+			if (cancelled) return;
+			num_baked = i + 1;
+		}
+	}
+};
+
+ofxBvh::~ofxBvh()
+{
+	unload();
+}
+
+void ofxBvh::load(string path)
+{
+	path = ofToDataPath(path);
+	
+	// the previous take goes first, with any loader or bake still using it
+	unload();
+	
+	if (cache_enabled && loadCache(path))
+	{
+		source_path = path;
+		loaded_from_cache = true;
+		num_loaded_frames = getNumStoredFrames();
+	}
+	else
+	{
+		source_path = path;
+		loaded_from_cache = false;
+		
+		if (!loadText(path))
+			return;
+		
+		if (cache_enabled && !loader && !saveCache())
+			ofLogVerbose("ofxBvh", "can't write motion cache for " + path);
+	}
+	
+	prepareTake();
+	
+	frame_index = current_index = 0;
+	
+	evaluateFrame(current_index);
+	
+	frame_new = false;
+}
+
+void ofxBvh::loadAsync(string path)
+{
+	load_job = ofPtr<LoadJob>(new LoadJob);
+	load_job->path = path;
+	
+	// the job's own ofxBvh already runs off the render thread
+	ofxBvh &o = load_job->bvh;
+	o.load_mode = load_mode;
+	o.cache_enabled = cache_enabled;
+	o.load_threads = load_threads;
+	o.compressed = compressed;
+	o.rotation_cache = rotation_cache;
+	o.progressive = false;
+	
+	ofxBvhWorkerPool::getShared().start(load_job);
+}
+
+void ofxBvh::swapTake(ofxBvh& other)
+{
+	// a bake or a progressive load works on the take it was started on
+	clearBake();
+	other.clearBake();
+	stopLoader();
+	other.stopLoader();
+	
+	std::swap(root, other.root);
+	joints.swap(other.joints);
+	skeleton.swap(other.skeleton);
+	
+	local_offsets.swap(other.local_offsets);
+	local_rotations.swap(other.local_rotations);
+	global_positions.swap(other.global_positions);
+	global_rotations.swap(other.global_rotations);
+	local_matrices.swap(other.local_matrices);
+	global_matrices.swap(other.global_matrices);
+	
+	frames.swap(other.frames);
+	channel_index.swap(other.channel_index);
+	channel_constant.swap(other.channel_constant);
+	static_joints.swap(other.static_joints);
+	rotation_slots.swap(other.rotation_slots);
+	rotations.swap(other.rotations);
+	rotations_ready.swap(other.rotations_ready);
+	compressed_motion.swap(other.compressed_motion);
+	decoded_frame.swap(other.decoded_frame);
+	
+	std::swap(total_channels, other.total_channels);
+	std::swap(frame_stride, other.frame_stride);
+	std::swap(num_folded_channels, other.num_folded_channels);
+	std::swap(num_rotation_slots, other.num_rotation_slots);
+	std::swap(num_frames, other.num_frames);
+	std::swap(frame_time, other.frame_time);
+	std::swap(num_loaded_frames, other.num_loaded_frames);
+	std::swap(frame_index, other.frame_index);
+	std::swap(current_index, other.current_index);
+	std::swap(pose_index, other.pose_index);
+	std::swap(decoded_index, other.decoded_index);
+	dirty_joints.swap(other.dirty_joints);
+	required_joints.swap(other.required_joints);
+	
+	source_path.swap(other.source_path);
+	std::swap(loaded_from_cache, other.loaded_from_cache);
+	
+	for (int i = 0; i < joints.size(); i++)
+		joints[i]->bvh = this;
+	
+	for (int i = 0; i < other.joints.size(); i++)
+		other.joints[i]->bvh = &other;
+}
+
+ofPtr<ofxBvh::MotionSource> ofxBvh::openSource(const string& path)
+{
+	ofPtr<MotionSource> source(new MotionSource);
+	
+	if (load_mode == LOAD_MAPPED)
+	{
+		try
+		{
+			source->mapping = ofPtr<Poco::SharedMemory>(new Poco::SharedMemory(Poco::File(path), Poco::SharedMemory::AM_READ));
+			source->begin = source->mapping->begin();
+			source->end = source->mapping->end();
+		}
+		catch (Poco::Exception &e)
+		{
+			ofLogVerbose("ofxBvh", "can't map " + path + ", falling back to buffered read: " + e.displayText());
+		}
+	}
+	
+	if (!source->begin)
+	{
+		source->buffer = ofBufferFromFile(path);
+		source->begin = source->buffer.getBinaryBuffer();
+		source->end = source->begin + source->buffer.size();
+	}
+	
+	return source;
+}
+
+bool ofxBvh::loadHeader(const string& path)
+{
+	ofPtr<MotionSource> source = openSource(path);
+	
+	const char *begin = source->begin;
+	const char *end = source->end;
+	
+	// a mapping only pages in what is scanned, which stops at MOTION
+	const char *HIERARCHY_BEGIN = findString(begin, end, "HIERARCHY");
+	const char *MOTION_BEGIN = findString(HIERARCHY_BEGIN, end, "MOTION");
+	
+	if (HIERARCHY_BEGIN == end
+		|| MOTION_BEGIN == end)
+	{
+		ofLogError("ofxBvh", "invalid bvh format: " + path);
+		return false;
+	}
+	
+	parseHierarchy(HIERARCHY_BEGIN, MOTION_BEGIN);
+	parseMotionHeader(MOTION_BEGIN, end);
+	
+	return root != NULL;
+}
+
+bool ofxBvh::loadText(const string& path)
+{
+	// shared with the loader thread when loading progressively
+	ofPtr<MotionSource> source = openSource(path);
+	
+	const char *begin = source->begin;
+	const char *end = source->end;
+	
+	const char *HIERARCHY_BEGIN = findString(begin, end, "HIERARCHY");
+	const char *MOTION_BEGIN = findString(HIERARCHY_BEGIN, end, "MOTION");
+	
+	if (HIERARCHY_BEGIN == end
+		|| MOTION_BEGIN == end)
+	{
+		ofLogError("ofxBvh", "invalid bvh format");
+		return false;
+	}
+	
+	parseHierarchy(HIERARCHY_BEGIN, MOTION_BEGIN);
+	
+	if (!root)
+	{
+		ofLogError("ofxBvh", "invalid bvh format");
+		return false;
+	}
+	
+	// without a Frames: count there is nowhere to publish into, parse it all
+	if (progressive)
+	{
+		const char *p = parseMotionHeader(MOTION_BEGIN, end);
+		
+		if (num_frames > 0)
+		{
+			const char *line, *line_end;
+			
+			resizeFrames(num_frames);
+			
+			int index = 0;
+			while (index < MotionLoader::CHUNK_FRAMES && index < num_frames
+				   && nextFrameLine(p, end, line, line_end))
+			{
+				if (!parseFrameData(line, line_end, getFrameData(index), total_channels))
+				{
+					ofLogError("ofxBvh", "channel size mismatch");
+					break;
+				}
+				
+				index++;
+			}
+			
+			num_loaded_frames = index;
+			
+			if (num_loaded_frames == 0)
+			{
+				resizeFrames(0);
+				ofLogError("ofxBvh", "invalid bvh format");
+				return false;
+			}
+			
+			if (index == MotionLoader::CHUNK_FRAMES && index < num_frames)
+			{
+				loader = ofPtr<MotionLoader>(new MotionLoader(this, source, p, index));
+				loader->startThread(true, false);
+			}
+			else
+			{
+				resizeFrames(num_loaded_frames);
+				
+				if (num_frames != num_loaded_frames)
+					ofLogWarning("ofxBvh", "frame size mismatch");
+			}
+			
+			return true;
+		}
+	}
+	
+	parseMotion(MOTION_BEGIN, end);
+	num_loaded_frames = getNumStoredFrames();
+	
+	if (num_loaded_frames == 0)
+	{
+		ofLogError("ofxBvh", "invalid bvh format");
+		return false;
+	}
+	
+	return true;
+}
+
+string ofxBvh::getCachePath(const string& path)
+{
+	return ofFilePath::removeExt(path) + ".bvhc";
+}
+
+template <typename T>
+static inline void appendValue(string& out, const T& v)
+{
+	out.append((const char*)&v, sizeof(T));
+}
+
+template <typename T>
+static inline bool readValue(const char *&p, const char *end, T& v)
+{
+	if (end - p < (ptrdiff_t)sizeof(T)) return false;
+	memcpy(&v, p, sizeof(T));
+	p += sizeof(T);
+	return true;
+}
+
+bool ofxBvh::saveCache()
+{
+	if (isLoading()) return false;
+	return writeCache(getNumStoredFrames());
+}
+
+static ofMutex temp_mutex;
+static int num_temp_files = 0;
+
+// a name no other writer uses, in this process or another, so a prefetch
+// and a load() of the same file don't fill one temp file
+static string getTempPath(const string& path)
+{
+	temp_mutex.lock();
+	int n = num_temp_files++;
+	temp_mutex.unlock();
+	
+	return path + "." + ofToString(Poco::Process::id()) + "." + ofToString(n) + ".tmp";
+}
+
+static void removeFile(const string& path)
+{
+	try
+	{
+		Poco::File(path).remove();
+	}
+	catch (Poco::Exception &e)
+	{
+	}
+}
+
+bool ofxBvh::writeCache(int num_frames)
+{
+	if (!root || num_frames <= 0 || source_path.empty()) return false;
+	
+	CacheHeader header;
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.byte_order = CACHE_BYTE_ORDER;
+	header.num_joints = skeleton->getNumJoints();
+	header.total_channels = total_channels;
+	header.num_frames = num_frames;
+	header.frame_time = frame_time;
+	
+	try
+	{
+		Poco::File source(source_path);
+		header.source_size = source.getSize();
+		header.source_modified = source.getLastModified().epochMicroseconds();
+	}
+	catch (Poco::Exception &e)
+	{
+		return false;
+	}
+	
+	string data;
+	data.append(sizeof(CacheHeader), '\0');
+	
+	for (int i = 0; i < skeleton->getNumJoints(); i++)
+	{
+		const ofxBvhSkeleton::Joint &joint = skeleton->getJoint(i);
+		
+		int num_channels = joint.channels.size();
+		int name_length = joint.name.size();
+		
+		appendValue(data, joint.parent);
+		appendValue(data, joint.offset.x);
+		appendValue(data, joint.offset.y);
+		appendValue(data, joint.offset.z);
+		appendValue(data, num_channels);
+		for (int n = 0; n < num_channels; n++)
+			appendValue(data, (unsigned char)joint.channels[n]);
+		appendValue(data, name_length);
+		data.append(joint.name);
+	}
+	
+	// align the frame block so it can be read in place from the mapping
+	data.append((16 - data.size() % 16) % 16, '\0');
+	header.frames_offset = data.size();
+	memcpy(&data[0], &header, sizeof(CacheHeader));
+	
+	vector<float> frame(total_channels);
+	
+	for (int i = 0; i < num_frames; i++)
+	{
+		readFrame(i, &frame[0]);
+		data.append((const char*)&frame[0], total_channels * sizeof(float));
+	}
+	
+	// write next to the final name first so a reader never sees a partial file
+	string path = getCachePath(source_path);
+	string temp_path = getTempPath(path);
+	
+	ofstream file(temp_path.c_str(), ios::out | ios::binary | ios::trunc);
+	file.write(data.data(), data.size());
+	file.close();
+	
+	if (!file)
+	{
+		removeFile(temp_path);
+		return false;
+	}
+	
+	try
+	{
+		Poco::File(temp_path).renameTo(path);
+	}
+	catch (Poco::Exception &e)
+	{
+		removeFile(temp_path);
+		return false;
+	}
+	
+	return true;
+}
+
+bool ofxBvh::loadCache(const string& path)
+{
+	string cache_path = getCachePath(path);
+	
+	ofPtr<Poco::SharedMemory> mapping;
+	long long source_size, source_modified;
+	
+	try
+	{
+		Poco::File source(path), cache(cache_path);
+		if (!cache.exists()) return false;
+		
+		source_size = source.getSize();
+		source_modified = source.getLastModified().epochMicroseconds();
+		
+		mapping = ofPtr<Poco::SharedMemory>(new Poco::SharedMemory(cache, Poco::SharedMemory::AM_READ));
+	}
+	catch (Poco::Exception &e)
+	{
+		return false;
+	}
+	
+	const char *begin = mapping->begin();
+	const char *end = mapping->end();
+	const char *p = begin;
+	
+	CacheHeader header;
+	if (!readValue(p, end, header)
+		|| memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0
+		|| header.version != CACHE_VERSION
+		|| header.byte_order != CACHE_BYTE_ORDER)
+	{
+		ofLogVerbose("ofxBvh", "ignoring incompatible motion cache " + cache_path);
+		return false;
+	}
+	
+	if (header.source_size != source_size
+		|| header.source_modified != source_modified)
+	{
+		ofLogVerbose("ofxBvh", "motion cache is stale: " + cache_path);
+		return false;
+	}
+	
+	const size_t frame_bytes = (size_t)header.num_frames * header.total_channels * sizeof(float);
+	if (header.num_frames <= 0 || header.num_joints <= 0
+		|| !(header.frame_time > 0)
+		|| header.frames_offset > (size_t)(end - begin)
+		|| frame_bytes > (size_t)(end - begin) - header.frames_offset)
+	{
+		ofLogError("ofxBvh", "corrupt motion cache " + cache_path);
+		return false;
+	}
+	
+	ofxBvhSkeleton desc;
+	
+	for (int i = 0; i < header.num_joints; i++)
+	{
+		int parent, num_channels, name_length;
+		ofVec3f offset;
+		
+		bool ok = readValue(p, end, parent)
+			&& (i == 0 ? parent == -1 : parent >= 0 && parent < i)
+			&& readValue(p, end, offset.x)
+			&& readValue(p, end, offset.y)
+			&& readValue(p, end, offset.z)
+			&& readValue(p, end, num_channels)
+			&& num_channels >= 0 && num_channels <= end - p;
+		
+		if (ok)
+		{
+			const char *channels = p;
+			p += num_channels;
+			
+			for (int n = 0; n < num_channels && ok; n++)
+				ok = (unsigned char)channels[n] <= ofxBvhJoint::Z_POSITION;
+			
+			ok = ok && readValue(p, end, name_length)
+				&& name_length >= 0 && name_length <= end - p;
+			
+			if (ok)
+			{
+				ofxBvhSkeleton::Joint &joint = desc.joints[desc.addJoint(string(p, name_length), parent)];
+				p += name_length;
+				
+				joint.offset = offset;
+				
+				joint.channels.resize(num_channels);
+				for (int n = 0; n < num_channels; n++)
+					joint.channels[n] = (ofxBvhJoint::CHANNEL)channels[n];
+				
+				desc.total_channels += num_channels;
+			}
+		}
+		
+		if (!ok)
+		{
+			ofLogError("ofxBvh", "corrupt motion cache " + cache_path);
+			return false;
+		}
+	}
+	
+	if (desc.total_channels != header.total_channels)
+	{
+		ofLogError("ofxBvh", "corrupt motion cache " + cache_path);
+		return false;
+	}
+	
+	setSkeleton(desc);
+	
+	num_frames = header.num_frames;
+	frame_time = header.frame_time;
+	
+	const float *data = (const float*)(begin + header.frames_offset);
+	
+	resizeFrames(num_frames);
+	for (int i = 0; i < num_frames; i++)
+	{
+		memcpy(getFrameData(i), data, total_channels * sizeof(float));
+		data += total_channels;
+	}
+	
+	return true;
+}
+
+void ofxBvh::unload()
+{
+	// an abandoned job finishes on its own and is dropped with its take
+	load_job.reset();
+	
+	clearBake();
+	stopLoader();
+	
+	for (int i = 0; i < joints.size(); i++)
+		delete joints[i];
+	
+	joints.clear();
+	skeleton.reset();
+	
+	local_offsets.clear();
+	local_rotations.clear();
+	global_positions.clear();
+	global_rotations.clear();
+	local_matrices.clear();
+	global_matrices.clear();
+	pose_index = -1;
+	dirty_joints.clear();
+	required_joints.clear();
+	
+	root = NULL;
+	
+	frames.clear();
+	frame_stride = 0;
+	
+	compressed_motion.reset();
+	decoded_frame.clear();
+	decoded_index = -1;
+	
+	channel_index.clear();
+	channel_constant.clear();
+	static_joints.clear();
+	num_folded_channels = 0;
+	
+	rotation_slots.clear();
+	rotations.clear();
+	rotations_ready.clear();
+	num_rotation_slots = 0;
+	
+	num_loaded_frames = 0;
+	frame_index = 0;
+	current_index = -1;
+	
+	num_frames = 0;
+	frame_time = 0;
+	
+	source_path.clear();
+	loaded_from_cache = false;
+	
+	rate = 1;
+	play_head = 0;
+	playing = false;
+	loop = false;
+	
+	need_update = false;
+}
+
+void ofxBvh::play()
+{
+	playing = true;
+}
+
+void ofxBvh::stop()
+{
+	playing = false;
+}
+
+bool ofxBvh::isPlaying()
+{
+	return playing;
+}
+
+void ofxBvh::setLoop(bool yn)
+{
+	loop = yn;
+}
+
+bool ofxBvh::isLoop() { return loop; }
+
+void ofxBvh::setRate(float rate)
+{
+	this->rate = rate;
+}
+
+inline float ofxBvh::getChannelValue(const float *frame_data, int channel) const
+{
+	const int slot = channel_index[channel];
+	
+	if (slot >= 0) return frame_data[slot];
+	return slot == CONSTANT_CHANNEL ? channel_constant[channel] : 0;
+}
+
+// joint transforms are a rotation followed by a translation. with oF's row
+// vectors the child's global is its local transform, then the parent's.
+static inline void compose(const ofQuaternion& rotate, const ofVec3f& translate,
+						   const ofQuaternion& parent_rotate, const ofVec3f& parent_translate,
+						   ofQuaternion& dst_rotate, ofVec3f& dst_translate)
+{
+	dst_translate = parent_rotate * translate + parent_translate;
+	dst_rotate = rotate * parent_rotate;
+}
+
+static inline void makeMatrix(const ofQuaternion& rotate, const ofVec3f& translate, ofMatrix4x4& m)
+{
+	m.makeRotationMatrix(rotate);
+	m.setTranslation(translate);
+}
+
+void ofxBvh::evaluateFrame(int index)
+{
+	const int num_joints = joints.size();
+	
+	pose_index = index;
+	
+	if (bake_job && index < bake_job->getNumBaked())
+	{
+		const size_t first = (size_t)index * num_joints;
+		std::copy(&bake_job->rotations[first], &bake_job->rotations[first] + num_joints, global_rotations.begin());
+		std::copy(&bake_job->positions[first], &bake_job->positions[first] + num_joints, global_positions.begin());
+		
+		std::fill(dirty_joints.begin(), dirty_joints.end(), LOCAL_DIRTY | LOCAL_MATRIX_DIRTY | GLOBAL_MATRIX_DIRTY);
+		return;
+	}
+	
+	const float *frame_data = getPoseFrame(index);
+	const ofQuaternion *frame_rotations = getPoseRotations(index, frame_data);
+	
+	const int *parents = &skeleton->getParents()[0];
+	const bool partial = !required_joints.empty();
+	
+	// parents come first, so their global transform is always ready
+	for (int j = 0; j < num_joints; j++)
+	{
+		if (partial && !required_joints[j])
+		{
+			dirty_joints[j] = LOCAL_DIRTY | GLOBAL_DIRTY | LOCAL_MATRIX_DIRTY | GLOBAL_MATRIX_DIRTY;
+			continue;
+		}
+		
+		if (!static_joints[j])
+		{
+			int slot = rotation_slots[j];
+			updateLocalTransform(j, frame_data, frame_rotations && slot >= 0 ? &frame_rotations[slot] : NULL);
+		}
+		
+		const int parent = parents[j];
+		
+		if (parent >= 0)
+			compose(local_rotations[j], local_offsets[j], global_rotations[parent], global_positions[parent],
+					global_rotations[j], global_positions[j]);
+		else
+		{
+			global_rotations[j] = local_rotations[j];
+			global_positions[j] = local_offsets[j];
+		}
+		
+		dirty_joints[j] = static_joints[j] ? GLOBAL_MATRIX_DIRTY : LOCAL_MATRIX_DIRTY | GLOBAL_MATRIX_DIRTY;
+	}
+}
+
+void ofxBvh::evaluateLocal(int joint)
+{
+	dirty_joints[joint] &= ~LOCAL_DIRTY;
+	
+	// static joints keep their local transform from the load
+	if (static_joints[joint] || pose_index < 0) return;
+	
+	const float *frame_data = getPoseFrame(pose_index);
+	const ofQuaternion *frame_rotations = getPoseRotations(pose_index, frame_data);
+	
+	int slot = rotation_slots[joint];
+	updateLocalTransform(joint, frame_data, frame_rotations && slot >= 0 ? &frame_rotations[slot] : NULL);
+	
+	dirty_joints[joint] |= LOCAL_MATRIX_DIRTY;
+}
+
+// the same operations evaluateFrame() does for the joint, only later
+void ofxBvh::evaluateGlobal(int joint)
+{
+	const int parent = skeleton->getParents()[joint];
+	
+	if (parent >= 0)
+		updateGlobal(parent);
+	
+	updateLocal(joint);
+	
+	if (parent >= 0)
+		compose(local_rotations[joint], local_offsets[joint], global_rotations[parent], global_positions[parent],
+				global_rotations[joint], global_positions[joint]);
+	else
+	{
+		global_rotations[joint] = local_rotations[joint];
+		global_positions[joint] = local_offsets[joint];
+	}
+	
+	dirty_joints[joint] = (dirty_joints[joint] & ~GLOBAL_DIRTY) | GLOBAL_MATRIX_DIRTY;
+}
+
+const ofMatrix4x4& ofxBvh::getLocalMatrix(int joint)
+{
+	updateLocal(joint);
+	
+	if (local_matrices.empty())
+	{
+		local_matrices.resize(joints.size());
+		for (int j = 0; j < joints.size(); j++)
+			dirty_joints[j] |= LOCAL_MATRIX_DIRTY;
+	}
+	
+	if (dirty_joints[joint] & LOCAL_MATRIX_DIRTY)
+	{
+		makeMatrix(local_rotations[joint], local_offsets[joint], local_matrices[joint]);
+		dirty_joints[joint] &= ~LOCAL_MATRIX_DIRTY;
+	}
+	
+	return local_matrices[joint];
+}
+
+const ofMatrix4x4& ofxBvh::getGlobalMatrix(int joint)
+{
+	updateGlobal(joint);
+	
+	if (global_matrices.empty())
+	{
+		global_matrices.resize(joints.size());
+		for (int j = 0; j < joints.size(); j++)
+			dirty_joints[j] |= GLOBAL_MATRIX_DIRTY;
+	}
+	
+	if (dirty_joints[joint] & GLOBAL_MATRIX_DIRTY)
+	{
+		makeMatrix(global_rotations[joint], global_positions[joint], global_matrices[joint]);
+		dirty_joints[joint] &= ~GLOBAL_MATRIX_DIRTY;
+	}
+	
+	return global_matrices[joint];
+}
+
+void ofxBvh::addRequiredJoint(int index)
+{
+	if (index < 0 || index >= joints.size())
+	{
+		ofLogError("ofxBvh", "no joint " + ofToString(index));
+		return;
+	}
+	
+	if (required_joints.empty())
+		required_joints.assign(joints.size(), 0);
+	
+	const vector<int> &parents = skeleton->getParents();
+	
+	for (int j = index; j >= 0 && !required_joints[j]; j = parents[j])
+		required_joints[j] = 1;
+}
+
+void ofxBvh::addRequiredJoint(const ofxBvhJoint *joint)
+{
+	if (joint && joint->getBvh() == this)
+		addRequiredJoint(joint->getIndex());
+	else
+		ofLogError("ofxBvh", "joint is not part of this take");
+}
+
+void ofxBvh::clearRequiredJoints()
+{
+	required_joints.clear();
+}
+
+void ofxBvh::computeGlobals(int index, float *frame_buffer, ofQuaternion *dst_rotations, ofVec3f *dst_positions)
+{
+	const float *frame_data = frame_buffer;
+	
+	if (compressed_motion)
+		compressed_motion->decode(index, frame_buffer);
+	else
+		frame_data = getFrameData(index);
+	
+	// the lazy cache is filled by the main thread, only a complete one is read
+	const ofQuaternion *frame_rotations = NULL;
+	if (rotation_cache == ROTATION_CACHE_LOAD && !rotations.empty())
+		frame_rotations = &rotations[(size_t)index * num_rotation_slots];
+	
+	const int *parents = &skeleton->getParents()[0];
+	
+	for (int j = 0; j < joints.size(); j++)
+	{
+		ofQuaternion rotate;
+		ofVec3f translate;
+		
+		if (static_joints[j])
+		{
+			rotate = local_rotations[j];
+			translate = local_offsets[j];
+		}
+		else
+		{
+			int slot = rotation_slots[j];
+			
+			rotate = frame_rotations && slot >= 0 ? frame_rotations[slot] : getRotation(frame_data, j);
+			translate = getTranslation(frame_data, j);
+		}
+		
+		if (parents[j] >= 0)
+			compose(rotate, translate, dst_rotations[parents[j]], dst_positions[parents[j]],
+					dst_rotations[j], dst_positions[j]);
+		else
+		{
+			dst_rotations[j] = rotate;
+			dst_positions[j] = translate;
+		}
+	}
+}
+
+bool ofxBvh::bake()
+{
+	if (isLoading())
+	{
+		ofLogError("ofxBvh", "can't bake a take that is still loading");
+		return false;
+	}
+	
+	clearBake();
+	
+	if (joints.empty() || getNumFrames() == 0)
+		return false;
+	
+	bake_job = ofPtr<BakeJob>(new BakeJob);
+	bake_job->bvh = this;
+	bake_job->num_frames = getNumFrames();
+	bake_job->num_joints = joints.size();
+	
+	ofxBvhWorkerPool::getShared().start(bake_job);
+	return true;
+}
+
+void ofxBvh::clearBake()
+{
+	if (!bake_job) return;
+	
+	bake_job->cancel();
+	bake_job->wait();
+	bake_job.reset();
+}
+
+bool ofxBvh::isBaking()
+{
+	return bake_job && !bake_job->isFinished();
+}
+
+bool ofxBvh::isBaked()
+{
+	return bake_job && bake_job->getNumBaked() == bake_job->num_frames;
+}
+
+float ofxBvh::getBakeProgress()
+{
+	return bake_job ? bake_job->getNumBaked() / (float)bake_job->num_frames : 0;
+}
+
+size_t ofxBvh::getBakeMemoryEstimate()
+{
+	return (size_t)getNumFrames() * joints.size() * (sizeof(ofQuaternion) + sizeof(ofVec3f));
+}
+
+void ofxBvh::updateLocalTransform(int joint, const float *frame_data, const ofQuaternion *rotation)
+{
+	local_offsets[joint] = getTranslation(frame_data, joint);
+	local_rotations[joint] = rotation ? *rotation : getRotation(frame_data, joint);
+}
+
+ofVec3f ofxBvh::getTranslation(const float *frame_data, int joint) const
+{
+	const int first = skeleton->getFirstChannels()[joint];
+	const int count = skeleton->getChannelCounts()[joint];
+	const ofxBvhSkeleton::Layout kind = use_kernels ? skeleton->getLayouts()[joint] : ofxBvhSkeleton::LAYOUT_GENERIC;
+	const ofxBvhJoint::CHANNEL *layout = &skeleton->getChannelLayout()[0];
+	
+	ofVec3f translate;
+	
+	if (kind >= ofxBvhSkeleton::LAYOUT_POSITION_XYZ)
+	{
+		translate.set(getChannelValue(frame_data, first),
+			getChannelValue(frame_data, first + 1),
+			getChannelValue(frame_data, first + 2));
+	}
+	else if (kind == ofxBvhSkeleton::LAYOUT_GENERIC)
+	{
+		for (int channel = first; channel < first + count; channel++)
+		{
+			int slot = channel_index[channel];
+			if (slot == SKIPPED_CHANNEL) continue;
+			
+			float v = slot == CONSTANT_CHANNEL ? channel_constant[channel] : frame_data[slot];
+			ofxBvhJoint::CHANNEL t = layout[channel];
+			
+			if (t == ofxBvhJoint::X_POSITION)
+				translate.x = v;
+			else if (t == ofxBvhJoint::Y_POSITION)
+				translate.y = v;
+			else if (t == ofxBvhJoint::Z_POSITION)
+				translate.z = v;
+		}
+	}
+	
+	return translate + skeleton->getRestOffsets()[joint];
+}
+
+void ofxBvh::update()
+{
+	advance(ofGetFrameNum() > 1 ? ofGetLastFrameTime() : 0);
+}
+
+void ofxBvh::advance(float dt)
+{
+	if (!updatePlayback(dt)) return;
+	
+	catchUp();
+	evaluateFrame(current_index);
+	notifyListeners();
+}
+
+bool ofxBvh::updatePlayback(float dt)
+{
+	frame_new = false;
+	num_skipped = 0;
+	
+	const bool moving = clock || playing;
+	const int shown_index = current_index;
+	const float shown_head = play_head;
+	
+	if (clock)
+	{
+		float duration = getDuration();
+		float t = clock->getTime();
+		
+		if (loop && duration > 0)
+		{
+			t = fmodf(t, duration);
+			if (t < 0) t += duration;
+		}
+		
+		play_head = ofClamp(t, 0, duration);
+		frame_index = getFrame();
+	}
+	else if (playing)
+	{
+		int last_index = getFrame();
+		
+		play_head += dt * rate;
+		int index = getFrame();
+		
+		if (index != last_index)
+		{
+			if (index >= getNumFrames())
+			{
+				if (loop)
+					play_head = 0;
+				else
+					playing = false;
+			}
+			
+			if (play_head < 0)
+				play_head = 0;
+			
+			frame_index = getFrame();
+		}
+	}
+	
+	// also picks up frames published since the last call
+	selectFrame(frame_index);
+	
+	if (moving)
+		countSkipped(shown_index, shown_head);
+	
+	if (!need_update) return false;
+	
+	need_update = false;
+	frame_new = true;
+	
+	return true;
+}
+
+void ofxBvh::countSkipped(int last_index, float last_head)
+{
+	const int num = getNumStoredFrames();
+	int passed = current_index - last_index;
+	
+	if (last_index < 0 || passed == 0 || num == 0) return;
+	
+	// over the end of a looping take the short way round is the one played
+	if (loop && abs(passed) > num / 2)
+		passed += passed > 0 ? -num : num;
+	
+	const int skipped = abs(passed) - 1;
+	if (skipped == 0 || skipped > max_catch_up) return;
+	
+	float span = ofClamp(play_head, 0, getDuration()) - last_head;
+	
+	if (span * passed < 0)
+		span += passed > 0 ? getDuration() : -getDuration();
+	
+	num_skipped = skipped;
+	skip_from = last_index;
+	skip_head = last_head;
+	skip_span = span;
+	
+	total_skipped += skipped;
+	num_drops++;
+	max_skipped = std::max(max_skipped, skipped);
+}
+
+void ofxBvh::catchUp()
+{
+	if (catch_up == CATCH_UP_NONE || listeners.empty() || num_skipped == 0) return;
+	
+	const int num = getNumStoredFrames();
+	const float duration = getDuration();
+	const int direction = skip_span < 0 ? -1 : 1;
+	
+	if (catch_up == CATCH_UP_INTERPOLATED && catch_up_pose.skeleton != skeleton)
+		catch_up_pose.allocate(*this);
+	
+	for (int k = 1; k <= num_skipped; k++)
+	{
+		float time;
+		
+		if (catch_up == CATCH_UP_FRAMES)
+		{
+			const int index = ((skip_from + k * direction) % num + num) % num;
+			if (index >= num_loaded_frames) break;
+			
+			evaluateFrame(index);
+			time = index * frame_time;
+		}
+		else
+		{
+			time = skip_head + skip_span * k / (num_skipped + 1);
+			
+			if (loop && duration > 0)
+			{
+				time = fmodf(time, duration);
+				if (time < 0) time += duration;
+			}
+			
+			if (!evaluate(time, loop, catch_up_pose)) break;
+			applyPose(catch_up_pose);
+		}
+		
+		for (int i = 0; i < listeners.size(); i++)
+			listeners[i]->newPose(*this, time);
+	}
+}
+
+void ofxBvh::notifyListeners()
+{
+	for (int i = 0; i < listeners.size(); i++)
+		listeners[i]->newPose(*this, current_index * frame_time);
+}
+
+void ofxBvh::applyPose(const ofxBvhPoseBuffer& pose)
+{
+	const int *parents = &skeleton->getParents()[0];
+	
+	// not a frame, nothing for evaluateLocal() to go back to
+	pose_index = -1;
+	
+	for (int j = 0; j < joints.size(); j++)
+	{
+		global_rotations[j] = pose.rotations[j];
+		global_positions[j] = pose.positions[j];
+		
+		dirty_joints[j] = GLOBAL_MATRIX_DIRTY;
+		
+		if (static_joints[j]) continue;
+		
+		// compose() the other way round
+		const int parent = parents[j];
+		
+		if (parent >= 0)
+		{
+			const ofQuaternion inverse = global_rotations[parent].inverse();
+			local_rotations[j] = global_rotations[j] * inverse;
+			local_offsets[j] = inverse * (global_positions[j] - global_positions[parent]);
+		}
+		else
+		{
+			local_rotations[j] = global_rotations[j];
+			local_offsets[j] = global_positions[j];
+		}
+		
+		dirty_joints[j] = LOCAL_MATRIX_DIRTY | GLOBAL_MATRIX_DIRTY;
+	}
+}
+
+void ofxBvh::addListener(Listener *listener)
+{
+	if (listener && std::find(listeners.begin(), listeners.end(), listener) == listeners.end())
+		listeners.push_back(listener);
+}
+
+void ofxBvh::removeListener(Listener *listener)
+{
+	listeners.erase(std::remove(listeners.begin(), listeners.end(), listener), listeners.end());
+}
+
+void ofxBvh::resetSkipCounters()
 {
-	unload();
+	total_skipped = 0;
+	num_drops = 0;
+	max_skipped = 0;
 }
 
-void ofxBvh::load(string path)
+void ofxBvh::selectFrame(int index)
 {
-	path = ofToDataPath(path);
-	
-	string data = ofBufferFromFile(path).getText();
+	int available = getNumLoadedFrames();
+	if (available == 0) return;
 	
-	const size_t HIERARCHY_BEGIN = data.find("HIERARCHY", 0);
-	const size_t MOTION_BEGIN = data.find("MOTION", 0);
+	index = ofClamp(index, 0, available - 1);
 	
-	if (HIERARCHY_BEGIN == string::npos
-		|| MOTION_BEGIN == string::npos)
+	if (index != current_index)
 	{
-		ofLogError("ofxBvh", "invalid bvh format");
-		return;
+		current_index = index;
+		
+		need_update = true;
 	}
+}
+
+void ofxBvh::draw()
+{
+	ofPushStyle();
+	ofFill();
 	
-	parseHierarchy(data.substr(HIERARCHY_BEGIN, MOTION_BEGIN));
-	parseMotion(data.substr(MOTION_BEGIN));
+	for (int i = 0; i < joints.size(); i++)
+		drawJoint(joints[i]->isRoot(), joints[i]->getChildren().size(), joints[i]->getGlobalMatrix());
 	
-	currentFrame = frames[0];
+	ofPopStyle();
+}
+
+void ofxBvh::drawJoint(bool root, int num_children, const ofMatrix4x4& global_matrix)
+{
+	glPushMatrix();
+	glMultMatrixf(global_matrix.getPtr());
 	
-	int index = 0;
-	updateJoint(index, currentFrame, root);
+	if (num_children == 0)
+	{
+		ofSetColor(ofColor::yellow);
+		billboard();
+		ofCircle(0, 0, 6);
+	}
+	else if (num_children == 1)
+	{
+		ofSetColor(ofColor::white);		
+		billboard();
+		ofCircle(0, 0, 2);
+	}
+	else
+	{
+		if (root)
+			ofSetColor(ofColor::cyan);
+		else
+			ofSetColor(ofColor::green);
+		
+		billboard();
+		ofCircle(0, 0, 4);
+	}
 	
-	frame_new = false;
+	glPopMatrix();
 }
 
-void ofxBvh::unload()
+bool ofxBvh::isFrameNew()
 {
-	for (int i = 0; i < joints.size(); i++)
-		delete joints[i];
+	return frame_new;
+}
+
+void ofxBvh::setFrame(int index)
+{
+	if (ofInRange(index, 0, getNumFrames() - 1))
+	{
+		if (getFrame() != index)
+			play_head = (float)index * frame_time;
+		
+		frame_index = index;
+		selectFrame(index);
+	}
+}
+
+int ofxBvh::getFrame()
+{
+	return floor(play_head / frame_time);
+}
+
+void ofxBvh::setPosition(float pos)
+{
+	setFrame((float)getNumFrames() * pos);
+}
+
+float ofxBvh::getPosition()
+{
+	return play_head / (float)getNumFrames();
+}
+
+float ofxBvh::getDuration()
+{
+	return (float)getNumFrames() * frame_time;
+}
+
+bool ofxBvh::evaluate(float time, ofxBvhPoseBuffer& pose) const
+{
+	return evaluate(time, loop, pose);
+}
+
+bool ofxBvh::evaluate(float time, bool looping, ofxBvhPoseBuffer& pose) const
+{
+	const int num = num_loaded_frames;
 	
-	joints.clear();
+	if (num == 0 || !skeleton || pose.skeleton != skeleton || pose.frame_data.size() < (size_t)frame_stride * 2)
+	{
+		ofLogError("ofxBvh", "evaluate() needs a loaded take and a pose allocated for it");
+		return false;
+	}
 	
-	root = NULL;
+	float position = frame_time > 0 ? time / frame_time : 0;
 	
-	frames.clear();
-	currentFrame.clear();
+	// a looping take also blends its last frame into the first
+	if (looping)
+	{
+		position = fmodf(position, (float)num);
+		if (position < 0) position += num;
+	}
+	else
+	{
+		position = ofClamp(position, 0, num - 1);
+	}
 	
-	num_frames = 0;
-	frame_time = 0;
+	const int index = std::min((int)position, num - 1);
+	const int next = index + 1 < num ? index + 1 : (looping ? 0 : index);
+	const float alpha = position - index;
 	
-	rate = 1;
-	play_head = 0;
-	playing = false;
-	loop = false;
+	const float *frame0 = &pose.frame_data[0];
+	const float *frame1 = &pose.frame_data[frame_stride];
 	
-	need_update = false;
+	if (compressed_motion)
+	{
+		compressed_motion->decode(index, &pose.frame_data[0]);
+		compressed_motion->decode(next, &pose.frame_data[frame_stride]);
+	}
+	else
+	{
+		frame0 = getFrameData(index);
+		frame1 = getFrameData(next);
+	}
+	
+	// the lazy cache is filled by update(), only a complete one is read
+	const ofQuaternion *rotations0 = NULL, *rotations1 = NULL;
+	if (rotation_cache == ROTATION_CACHE_LOAD && !rotations.empty())
+	{
+		rotations0 = &rotations[(size_t)index * num_rotation_slots];
+		rotations1 = &rotations[(size_t)next * num_rotation_slots];
+	}
+	
+	const int *parents = &skeleton->getParents()[0];
+	ofQuaternion *dst_rotations = &pose.rotations[0];
+	ofVec3f *dst_positions = &pose.positions[0];
+	
+	for (int j = 0; j < joints.size(); j++)
+	{
+		ofVec3f translate;
+		ofQuaternion rotate;
+		
+		if (static_joints[j])
+		{
+			translate = local_offsets[j];
+			rotate = local_rotations[j];
+		}
+		else
+		{
+			const int slot = rotation_slots[j];
+			
+			translate = getTranslation(frame0, j);
+			rotate = rotations0 && slot >= 0 ? rotations0[slot] : getRotation(frame0, j);
+			
+			// exactly the frame's pose when the time falls on it
+			if (alpha > 0)
+			{
+				const ofQuaternion rotate1 = rotations1 && slot >= 0 ? rotations1[slot] : getRotation(frame1, j);
+				
+				translate += (getTranslation(frame1, j) - translate) * alpha;
+				rotate.slerp(alpha, ofQuaternion(rotate), rotate1);
+			}
+		}
+		
+		if (parents[j] >= 0)
+			compose(rotate, translate, dst_rotations[parents[j]], dst_positions[parents[j]],
+					dst_rotations[j], dst_positions[j]);
+		else
+		{
+			dst_rotations[j] = rotate;
+			dst_positions[j] = translate;
+		}
+	}
+	
+	pose.time = time;
+	return true;
 }
 
-void ofxBvh::play()
+void ofxBvhPoseBuffer::allocate(const ofxBvh& bvh)
 {
-	playing = true;
+	skeleton = bvh.getSkeleton();
+	positions.assign(bvh.getNumJoints(), ofVec3f());
+	rotations.assign(bvh.getNumJoints(), ofQuaternion());
+	frame_data.assign((size_t)bvh.frame_stride * 2, 0);
+	time = 0;
 }
 
-void ofxBvh::stop()
+size_t ofxBvhPoseBuffer::getMemoryUsage() const
 {
-	playing = false;
+	return sizeof(ofxBvhPoseBuffer) + positions.capacity() * sizeof(ofVec3f)
+		+ rotations.capacity() * sizeof(ofQuaternion) + frame_data.capacity() * sizeof(float);
 }
 
-bool ofxBvh::isPlaying()
+ofMatrix4x4 ofxBvhPoseBuffer::getGlobalMatrix(int joint) const
 {
-	return playing;
+	ofMatrix4x4 m;
+	makeMatrix(rotations[joint], positions[joint], m);
+	return m;
 }
 
-void ofxBvh::setLoop(bool yn)
+int ofxBvh::getNumFrames()
 {
-	loop = yn;
+	updateLoader();
+	return getNumStoredFrames();
 }
 
-bool ofxBvh::isLoop() { return loop; }
+int ofxBvh::getNumLoadedFrames()
+{
+	updateLoader();
+	return num_loaded_frames;
+}
 
-void ofxBvh::setRate(float rate)
+bool ofxBvh::isLoading()
 {
-	this->rate = rate;
+	updateLoader();
+	return load_job || loader;
 }
 
-void ofxBvh::updateJoint(int& index, const FrameData& frame_data, ofxBvhJoint *joint)
+void ofxBvh::waitForLoad()
 {
-	ofVec3f translate;
-	ofQuaternion rotate;
+	if (load_job)
+	{
+		load_job->wait();
+		updateLoader();
+	}
+	
+	if (loader)
+	{
+		loader->waitForThread(false);
+		updateLoader();
+	}
+}
+
+void ofxBvh::updateLoader()
+{
+	if (load_job && load_job->isFinished())
+	{
+		// the old take goes away with the job
+		swapTake(load_job->bvh);
+		load_job.reset();
+	}
+	
+	if (!loader) return;
+	
+	loader->lock();
+	num_loaded_frames = loader->num_loaded;
+	bool done = loader->done;
+	loader->unlock();
 	
-	for (int i = 0; i < joint->channel_type.size(); i++)
+	if (done)
 	{
-		float v = frame_data[index++];
-		ofxBvhJoint::CHANNEL t = joint->channel_type[i];
+		loader->waitForThread(false);
+		loader.reset();
 		
-		if (t == ofxBvhJoint::X_POSITION)
-			translate.x = v;
-		else if (t == ofxBvhJoint::Y_POSITION)
-			translate.y = v;
-		else if (t == ofxBvhJoint::Z_POSITION)
-			translate.z = v;
-		else if (t == ofxBvhJoint::X_ROTATION)
-			rotate = ofQuaternion(v, ofVec3f(1, 0, 0)) * rotate;
-		else if (t == ofxBvhJoint::Y_ROTATION)
-			rotate = ofQuaternion(v, ofVec3f(0, 1, 0)) * rotate;
-		else if (t == ofxBvhJoint::Z_ROTATION)
-			rotate = ofQuaternion(v, ofVec3f(0, 0, 1)) * rotate;
+		// drop the slots a short MOTION section never filled
+		resizeFrames(num_loaded_frames);
+		
+		prepareTake();
+	}
+}
+
+void ofxBvh::stopLoader()
+{
+	if (!loader) return;
+	
+	loader->waitForThread(true);
+	loader.reset();
+}
+
+void ofxBvh::parseHierarchy(const char *begin, const char *end)
+{
+	Tokenizer tokens(begin, end);
+	ofxBvhSkeleton desc;
+	
+	total_channels = 0;
+	num_frames = 0;
+	frame_time = 0;
+	
+	while (tokens.next())
+	{
+		if (tokens.is("ROOT"))
+		{
+			if (parseJoint(tokens, desc, -1) < 0)
+				return;
+		}
+	}
+	
+	if (desc.getNumJoints() > 0)
+		setSkeleton(desc);
+}
+
+void ofxBvh::setSkeleton(const ofxBvhSkeleton& desc)
+{
+	skeleton = ofxBvhSkeleton::share(desc);
+	total_channels = skeleton->getNumChannels();
+	frame_stride = std::max(4, (total_channels + 3) & ~3);
+	
+	channel_index.resize(total_channels);
+	for (int i = 0; i < total_channels; i++)
+		channel_index[i] = i;
+	
+	channel_constant.assign(total_channels, 0);
+	static_joints.assign(skeleton->getNumJoints(), 0);
+	num_folded_channels = 0;
+	
+	rotation_slots.assign(skeleton->getNumJoints(), -1);
+	
+	local_offsets = skeleton->getRestOffsets();
+	local_rotations.assign(skeleton->getNumJoints(), ofQuaternion());
+	global_positions.assign(skeleton->getNumJoints(), ofVec3f());
+	global_rotations.assign(skeleton->getNumJoints(), ofQuaternion());
+	local_matrices.clear();
+	global_matrices.clear();
+	
+	dirty_joints.assign(skeleton->getNumJoints(), 0);
+	required_joints.clear();
+	
+	for (int i = 0; i < joints.size(); i++)
+		delete joints[i];
+	
+	joints.clear();
+	
+	for (int i = 0; i < skeleton->getNumJoints(); i++)
+	{
+		const ofxBvhSkeleton::Joint &o = skeleton->getJoint(i);
+		
+		ofxBvhJoint *parent = o.parent < 0 ? NULL : joints[o.parent];
+		ofxBvhJoint *joint = new ofxBvhJoint(skeleton.get(), i, parent);
+		if (parent) parent->children.push_back(joint);
+		
+		joint->bvh = this;
+		
+		joints.push_back(joint);
+	}
+	
+	root = joints[0];
+}
+
+// indices rather than references into desc, which grows while recursing
+int ofxBvh::parseJoint(Tokenizer& tokens, ofxBvhSkeleton& desc, int parent)
+{
+	tokens.next();
+	int index = desc.addJoint(tokens.str(), parent);
+	
+	while (tokens.next())
+	{
+		if (tokens.is("OFFSET"))
+		{
+			ofVec3f &offset = desc.joints[index].offset;
+			offset.x = tokens.nextFloat();
+			offset.y = tokens.nextFloat();
+			offset.z = tokens.nextFloat();
+		}
+		else if (tokens.is("CHANNELS"))
+		{
+			int num = tokens.nextInt();
+			
+			vector<ofxBvhJoint::CHANNEL> &channels = desc.joints[index].channels;
+			channels.resize(num);
+			desc.total_channels += num;
+			
+			for (int i = 0; i < num; i++)
+			{
+				tokens.next();
+				
+				char axis = tolower(tokens.at(0));
+				char elem = tolower(tokens.at(1));
+				
+				if (elem == 'p')
+				{
+					if (axis == 'x')
+						channels[i] = ofxBvhJoint::X_POSITION;
+					else if (axis == 'y')
+						channels[i] = ofxBvhJoint::Y_POSITION;
+					else if (axis == 'z')
+						channels[i] = ofxBvhJoint::Z_POSITION;
+					else
+					{
+						ofLogError("ofxBvh", "invalid bvh format");
+						return -1;
+					}
+				}
+				else if (elem == 'r')
+				{
+					if (axis == 'x')
+						channels[i] = ofxBvhJoint::X_ROTATION;
+					else if (axis == 'y')
+						channels[i] = ofxBvhJoint::Y_ROTATION;
+					else if (axis == 'z')
+						channels[i] = ofxBvhJoint::Z_ROTATION;
+					else
+					{
+						ofLogError("ofxBvh", "invalid bvh format");
+						return -1;
+					}
+				}
+				else
+				{
+					ofLogError("ofxBvh", "invalid bvh format");
+					return -1;
+				}
+			}
+		}
+		else if (tokens.is("JOINT")
+				 || tokens.is("End"))
+		{
+			if (parseJoint(tokens, desc, index) < 0)
+				return -1;
+		}
+		else if (tokens.is("}"))
+		{
+			break;
+		}
+	}
+	
+	return index;
+}
+
+const char* ofxBvh::parseMotionHeader(const char *begin, const char *end)
+{
+	const char *line = begin;
+	const char *line_end;
+	
+	while (line < end)
+	{
+		line_end = nextLine(line, end);
+		const char *next = skipNewline(line_end, end);
+		
+		trimLine(line, line_end);
+		
+		if (line == line_end) {}
+		else if (findString(line, line_end, "MOTION") != line_end) {}
+		else if (findString(line, line_end, "Frames:") != line_end)
+		{
+			num_frames = strtol(string(std::find(line, line_end, ':') + 1, line_end).c_str(), NULL, 10);
+		}
+		else if (findString(line, line_end, "Frame Time:") != line_end)
+		{
+			parseFloat(std::find(line, line_end, ':') + 1, line_end, frame_time);
+		}
+		else break;
+		
+		line = next;
 	}
 	
-	translate += joint->initial_offset;
+	return line;
+}
+
+void ofxBvh::parseMotion(const char *begin, const char *end)
+{
+	const char *p = parseMotionHeader(begin, end);
+	const char *line, *line_end;
 	
-	joint->matrix.makeIdentityMatrix();
-	joint->matrix.glTranslate(translate);
-	joint->matrix.glRotate(rotate);
+	// small takes aren't worth the thread start up
+	static const int MIN_BYTES_PER_THREAD = 64 * 1024;
 	
-	joint->global_matrix = joint->matrix;
-	joint->offset = translate;
+	int num_threads = load_threads > 0 ? load_threads : Poco::Environment::processorCount();
+	num_threads = std::min<int>(num_threads, (end - p) / MIN_BYTES_PER_THREAD);
 	
-	if (joint->parent)
+	if (num_threads > 1)
 	{
-		joint->global_matrix.postMult(joint->parent->global_matrix);
+		parseMotionParallel(p, end, num_threads);
+		return;
 	}
 	
-	for (int i = 0; i < joint->children.size(); i++)
+	frames.reserve((size_t)std::max(num_frames, 0) * frame_stride);
+	
+	int index = 0;
+	
+	while (nextFrameLine(p, end, line, line_end))
 	{
-		updateJoint(index, frame_data, joint->children[i]);
+		resizeFrames(index + 1);
+		
+		if (!parseFrameData(line, line_end, getFrameData(index), total_channels))
+		{
+			resizeFrames(index);
+			ofLogError("ofxBvh", "channel size mismatch");
+			return;
+		}
+		
+		index++;
 	}
+	
+	if (num_frames != index)
+		ofLogWarning("ofxBvh", "frame size mismatch");
 }
 
-void ofxBvh::update()
+void ofxBvh::parseMotionParallel(const char *begin, const char *end, int num_threads)
 {
-	frame_new = false;
+	vector<MotionRange> ranges(num_threads);
 	
-	if (playing && ofGetFrameNum() > 1)
+	const size_t range_size = (end - begin) / num_threads;
+	const char *p = begin;
+	
+	for (int i = 0; i < num_threads; i++)
 	{
-		int last_index = getFrame();
+		ranges[i].begin = p;
 		
-		play_head += ofGetLastFrameTime() * rate;
-		int index = getFrame();
+		if (i == num_threads - 1)
+			p = end;
+		else
+			p = skipNewline(nextLine(std::max(p, begin + range_size * (i + 1)), end), end);
 		
-		if (index != last_index)
-		{
-			need_update = true;
-			
-			currentFrame = frames[index];
-			
-			if (index >= frames.size())
-			{
-				if (loop)
-					play_head = 0;
-				else
-					playing = false;
-			}
-			
-			if (play_head < 0)
-				play_head = 0;
-		}
+		ranges[i].end = p;
 	}
 	
-	if (need_update)
+	runRanges(ranges);
+	
+	int total_lines = 0;
+	for (int i = 0; i < ranges.size(); i++)
+		total_lines += ranges[i].num_lines;
+	
+	resizeFrames(total_lines);
+	
+	int first_line = 0;
+	for (int i = 0; i < ranges.size(); i++)
 	{
-		need_update = false;
-		frame_new = true;
+		// an empty range gets no pointer, its start may be the end of frames
+		ranges[i].frames = ranges[i].num_lines ? getFrameData(first_line) : NULL;
+		ranges[i].frame_stride = frame_stride;
+		ranges[i].total_channels = total_channels;
+		ranges[i].counting = false;
 		
-		int index = 0;
-		updateJoint(index, currentFrame, root);
+		first_line += ranges[i].num_lines;
 	}
-}
-
-void ofxBvh::draw()
-{
-	ofPushStyle();
-	ofFill();
 	
-	for (int i = 0; i < joints.size(); i++)
+	runRanges(ranges);
+	
+	// keep everything before the first bad line, like the sequential parser
+	first_line = 0;
+	for (int i = 0; i < ranges.size(); i++)
 	{
-		ofxBvhJoint *o = joints[i];
-		glPushMatrix();
-		glMultMatrixf(o->getGlobalMatrix().getPtr());
-		
-		if (o->isSite())
+		if (ranges[i].error_line >= 0)
 		{
-			ofSetColor(ofColor::yellow);
-			billboard();
-			ofCircle(0, 0, 6);
-		}
-		else if (o->getChildren().size() == 1)
-		{
-			ofSetColor(ofColor::white);		
-			billboard();
-			ofCircle(0, 0, 2);
-		}
-		else if (o->getChildren().size() > 1)
-		{
-			if (o->isRoot())
-				ofSetColor(ofColor::cyan);
-			else
-				ofSetColor(ofColor::green);
-			
-			billboard();
-			ofCircle(0, 0, 4);
+			resizeFrames(first_line + ranges[i].error_line);
+			ofLogError("ofxBvh", "channel size mismatch");
+			return;
 		}
 		
-		glPopMatrix();
+		first_line += ranges[i].num_lines;
 	}
 	
-	ofPopStyle();
+	if (num_frames != total_lines)
+		ofLogWarning("ofxBvh", "frame size mismatch");
 }
 
-bool ofxBvh::isFrameNew()
+int ofxBvh::getNumStoredFrames() const
 {
-	return frame_new;
+	if (compressed_motion) return compressed_motion->getNumFrames();
+	return frame_stride ? frames.size() / frame_stride : 0;
 }
 
-void ofxBvh::setFrame(int index)
+void ofxBvh::setCompressed(bool yn)
 {
-	if (ofInRange(index, 0, frames.size()) && getFrame() != index)
+	compressed = yn;
+	
+	// a take still loading is compressed once it is done
+	if (!isLoading())
 	{
-		currentFrame = frames[index];
-		play_head = (float)index * frame_time;
+		// a bake reads the frames, and was taken from the other representation
+		const bool rebake = bake_job.get() != NULL;
+		clearBake();
 		
-		need_update = true;
+		applyCompression();
+		
+		// cached rotations were built from the other representation
+		buildRotations();
+		
+		if (rebake) bake();
 	}
 }
 
-int ofxBvh::getFrame()
+float ofxBvh::getCompressionRatio() const
 {
-	return floor(play_head / frame_time);
+	return compressed_motion ? compressed_motion->getCompressionRatio() : 1;
 }
 
-void ofxBvh::setPosition(float pos)
+float ofxBvh::getCompressionError() const
 {
-	setFrame((float)frames.size() * pos);
+	return compressed_motion ? compressed_motion->getMaxError() : 0;
 }
 
-float ofxBvh::getPosition()
+void ofxBvh::applyCompression()
 {
-	return play_head / (float)frames.size();
+	if (loader) return;
+	
+	if (compressed && !compressed_motion && getNumStoredFrames() > 0)
+	{
+		ofxBvhCompressedMotion *o = new ofxBvhCompressedMotion;
+		o->encode(getFrameData(0), getNumStoredFrames(), frame_stride, total_channels - num_folded_channels);
+		
+		compressed_motion = ofPtr<const ofxBvhCompressedMotion>(o);
+		decoded_frame.assign(frame_stride, 0);
+		decoded_index = -1;
+		FrameBuffer().swap(frames);
+	}
+	else if (!compressed && compressed_motion)
+	{
+		ofPtr<const ofxBvhCompressedMotion> o = compressed_motion;
+		compressed_motion.reset();
+		
+		resizeFrames(o->getNumFrames());
+		for (int i = 0; i < o->getNumFrames(); i++)
+			o->decode(i, getFrameData(i));
+		
+		FrameBuffer().swap(decoded_frame);
+		decoded_index = -1;
+	}
 }
 
-float ofxBvh::getDuration()
+const float* ofxBvh::getPoseFrame(int index)
 {
-	return (float)frames.size() * frame_time;
+	if (!compressed_motion)
+		return getFrameData(index);
+	
+	// joints evaluated late ask for the same frame again
+	if (index != decoded_index)
+	{
+		compressed_motion->decode(index, &decoded_frame[0]);
+		decoded_index = index;
+	}
+	
+	return &decoded_frame[0];
 }
 
-void ofxBvh::parseHierarchy(const string& data)
+void ofxBvh::foldConstantChannels()
 {
-	vector<string> tokens;
-	string token;
+	const int num_stored = getNumStoredFrames();
+	if (loader || compressed_motion || num_folded_channels > 0 || num_stored == 0) return;
 	
-	total_channels = 0;
-	num_frames = 0;
-	frame_time = 0;
+	const float *first = getFrameData(0);
+	vector<char> constant(total_channels, 1);
 	
-	for (int i = 0; i < data.size(); i++)
+	for (int i = 1; i < num_stored; i++)
 	{
-		char c = data[i];
+		const float *frame = getFrameData(i);
 		
-		if (isspace(c))
+		for (int c = 0; c < total_channels; c++)
+			if (constant[c] && frame[c] != first[c])
+				constant[c] = 0;
+	}
+	
+	vector<int> varying;
+	
+	for (int c = 0; c < total_channels; c++)
+	{
+		if (constant[c])
 		{
-			if (!token.empty()) tokens.push_back(token);
-			token.clear();
+			channel_constant[c] = first[c];
+			channel_index[c] = first[c] == 0 ? SKIPPED_CHANNEL : CONSTANT_CHANNEL;
 		}
 		else
 		{
-			token.push_back(c);
+			channel_index[c] = varying.size();
+			varying.push_back(c);
 		}
 	}
 	
-	int index = 0;
-	while (index < tokens.size())
+	num_folded_channels = total_channels - varying.size();
+	if (num_folded_channels == 0) return;
+	
+	const int stride = std::max(4, ((int)varying.size() + 3) & ~3);
+	FrameBuffer packed((size_t)num_stored * stride, 0);
+	
+	for (int i = 0; i < num_stored; i++)
+	{
+		const float *frame = getFrameData(i);
+		float *dst = &packed[(size_t)i * stride];
+		
+		for (int k = 0; k < varying.size(); k++)
+			dst[k] = frame[varying[k]];
+	}
+	
+	frames.swap(packed);
+	frame_stride = stride;
+	
+	for (int j = 0; j < joints.size(); j++)
 	{
-		if (tokens[index++] == "ROOT")
+		const ofxBvhSkeleton::Joint &desc = skeleton->getJoint(j);
+		
+		bool is_static = true;
+		for (int i = 0; i < desc.channels.size(); i++)
+			if (channel_index[desc.first_channel + i] >= 0)
+				is_static = false;
+		
+		if (is_static)
 		{
-			root = parseJoint(index, tokens, NULL);
+			updateLocalTransform(j, NULL, NULL);
+			dirty_joints[j] |= LOCAL_MATRIX_DIRTY;
 		}
+		
+		static_joints[j] = is_static;
 	}
+	
+	ofLogVerbose("ofxBvh", "folded " + ofToString(num_folded_channels) + " of "
+		+ ofToString(total_channels) + " channels");
+}
+
+void ofxBvh::prepareTake()
+{
+	foldConstantChannels();
+	applyCompression();
+	buildRotations();
 }
 
-ofxBvhJoint* ofxBvh::parseJoint(int& index, vector<string> &tokens, ofxBvhJoint *parent)
+void ofxBvh::setRotationCache(RotationCache mode)
 {
-	string name = tokens[index++];
-	ofxBvhJoint *joint = new ofxBvhJoint(name, parent);
-	if (parent) parent->children.push_back(joint);
+	// a bake may be reading the rotations
+	const bool rebake = bake_job.get() != NULL;
+	clearBake();
 	
-	joint->bvh = this;
+	rotation_cache = mode;
 	
-	joints.push_back(joint);
-	jointMap[name] = joint;
+	// a take still loading gets its rotations once it is done
+	if (!isLoading())
+	{
+		buildRotations();
+		
+		if (rebake) bake();
+	}
+}
+
+void ofxBvh::buildRotations()
+{
+	rotations.clear();
+	rotations_ready.clear();
+	
+	rotation_slots.assign(joints.size(), -1);
+	num_rotation_slots = 0;
 	
-	while (index < tokens.size())
+	const int num_stored = getNumStoredFrames();
+	if (rotation_cache == ROTATION_CACHE_NONE || loader || num_stored == 0) return;
+	
+	for (int j = 0; j < joints.size(); j++)
 	{
-		string token = tokens[index++];
+		if (static_joints[j]) continue;
 		
-		if (token == "OFFSET")
-		{
-			joint->initial_offset.x = ofToFloat(tokens[index++]);
-			joint->initial_offset.y = ofToFloat(tokens[index++]);
-			joint->initial_offset.z = ofToFloat(tokens[index++]);
-			
-			joint->offset = joint->initial_offset;
-		}
-		else if (token == "CHANNELS")
+		const ofxBvhSkeleton::Joint &desc = skeleton->getJoint(j);
+		
+		for (int i = 0; i < desc.channels.size(); i++)
 		{
-			int num = ofToInt(tokens[index++]);
-			
-			joint->channel_type.resize(num);
-			total_channels += num;
-			
-			for (int i = 0; i < num; i++)
+			if (desc.channels[i] <= ofxBvhJoint::Z_ROTATION)
 			{
-				string ch = tokens[index++];
-				
-				char axis = tolower(ch[0]);
-				char elem = tolower(ch[1]);
-				
-				if (elem == 'p')
-				{
-					if (axis == 'x')
-						joint->channel_type[i] = ofxBvhJoint::X_POSITION;
-					else if (axis == 'y')
-						joint->channel_type[i] = ofxBvhJoint::Y_POSITION;
-					else if (axis == 'z')
-						joint->channel_type[i] = ofxBvhJoint::Z_POSITION;
-					else
-					{
-						ofLogError("ofxBvh", "invalid bvh format");
-						return NULL;
-					}
-				}
-				else if (elem == 'r')
-				{
-					if (axis == 'x')
-						joint->channel_type[i] = ofxBvhJoint::X_ROTATION;
-					else if (axis == 'y')
-						joint->channel_type[i] = ofxBvhJoint::Y_ROTATION;
-					else if (axis == 'z')
-						joint->channel_type[i] = ofxBvhJoint::Z_ROTATION;
-					else
-					{
-						ofLogError("ofxBvh", "invalid bvh format");
-						return NULL;
-					}
-				}
-				else
-				{
-					ofLogError("ofxBvh", "invalid bvh format");
-					return NULL;
-				}
+				rotation_slots[j] = num_rotation_slots++;
+				break;
 			}
 		}
-		else if (token == "JOINT"
-				 || token == "End")
-		{
-			parseJoint(index, tokens, joint);
-		}
-		else if (token == "}")
-		{
-			break;
-		}
 	}
 	
-	return joint;
+	rotations.resize((size_t)num_stored * num_rotation_slots);
+	
+	if (rotation_cache == ROTATION_CACHE_LAZY)
+	{
+		rotations_ready.assign(num_stored, 0);
+		return;
+	}
+	
+	for (int i = 0; i < num_stored; i++)
+		computeRotations(getPoseFrame(i), &rotations[(size_t)i * num_rotation_slots]);
 }
 
-void ofxBvh::parseMotion(const string& data)
+void ofxBvh::computeRotations(const float *frame_data, ofQuaternion *dst)
 {
-	vector<string> lines = ofSplitString(data, "\n", true, true);
+	for (int j = 0; j < joints.size(); j++)
+		if (rotation_slots[j] >= 0)
+			dst[rotation_slots[j]] = getRotation(frame_data, j);
+}
+
+const ofQuaternion* ofxBvh::getPoseRotations(int index, const float *frame_data)
+{
+	if (rotations.empty()) return NULL;
 	
-	int index = 0;
+	ofQuaternion *dst = &rotations[(size_t)index * num_rotation_slots];
+	
+	if (!rotations_ready.empty() && !rotations_ready[index])
+	{
+		computeRotations(frame_data, dst);
+		rotations_ready[index] = 1;
+	}
+	
+	return dst;
+}
+
+// q = rotation about Axis * q. the terms of the full product that are
+// zero for a single axis rotation are left out, the rest is evaluated in
+// the same order so the result is bit identical.
+template <int Axis>
+static inline void premultiplyAxis(ofQuaternion &q, float degrees)
+{
+	const ofQuaternion r(degrees, ofVec3f(Axis == 0, Axis == 1, Axis == 2));
+	const float s = Axis == 0 ? r.x() : Axis == 1 ? r.y() : r.z();
+	const float c = r.w();
+	
+	const float x = q.x(), y = q.y(), z = q.z(), w = q.w();
+	
+	if (Axis == 0)
+		q.set(w * s + c * x, c * y + z * s, c * z - y * s, c * w - s * x);
+	else if (Axis == 1)
+		q.set(c * x - z * s, w * s + c * y, c * z + x * s, c * w - s * y);
+	else
+		q.set(c * x + y * s, c * y - x * s, w * s + c * z, c * w - s * z);
+}
+
+// euler angles in file order, A is applied first
+template <int A, int B, int C>
+static inline ofQuaternion eulerRotation(const float *v)
+{
+	ofQuaternion q(v[0], ofVec3f(A == 0, A == 1, A == 2));
+	premultiplyAxis<B>(q, v[1]);
+	premultiplyAxis<C>(q, v[2]);
+	
+	return q;
+}
+
+// same order of multiplication as the channels appear in the file
+ofQuaternion ofxBvh::getRotation(const float *frame_data, int joint) const
+{
+	const int first = skeleton->getFirstChannels()[joint];
+	const int count = skeleton->getChannelCounts()[joint];
+	const ofxBvhSkeleton::Layout kind = use_kernels ? skeleton->getLayouts()[joint] : ofxBvhSkeleton::LAYOUT_GENERIC;
 	
-	while (index < lines.size())
+	if (kind != ofxBvhSkeleton::LAYOUT_GENERIC)
 	{
-		string line = lines[index];
+		const int offset = kind >= ofxBvhSkeleton::LAYOUT_POSITION_XYZ ? 3 : 0;
 		
-		if (line.empty())
-		{
-			index++;
-			continue;
-		}
+		float v[3];
+		for (int i = 0; i < 3; i++)
+			v[i] = getChannelValue(frame_data, first + offset + i);
 		
-		if (line.find("MOTION") != string::npos) {}
-		else if (line.find("Frames:") != string::npos)
-		{
-			num_frames = ofToInt(ofSplitString(line, ":")[1]);
-		}
-		else if (line.find("Frame Time:") != string::npos)
+		switch ((kind - 1) % 6)
 		{
-			frame_time = ofToFloat(ofSplitString(line, ":")[1]);
+			case 0: return eulerRotation<0, 1, 2>(v);
+			case 1: return eulerRotation<0, 2, 1>(v);
+			case 2: return eulerRotation<1, 0, 2>(v);
+			case 3: return eulerRotation<1, 2, 0>(v);
+			case 4: return eulerRotation<2, 0, 1>(v);
+			default: return eulerRotation<2, 1, 0>(v);
 		}
-		else break;
-		
-		index++;
 	}
 	
-	while (index < lines.size())
+	const ofxBvhJoint::CHANNEL *layout = &skeleton->getChannelLayout()[0];
+	
+	ofQuaternion rotate;
+	
+	for (int channel = first; channel < first + count; channel++)
 	{
-		string line = lines[index];
-		vector<string> channels = ofSplitString(line, " ");
-
-		if (channels.size() != total_channels)
-		{
-			ofLogError("ofxBvh", "channel size mismatch");
-			return;
-		}
+		int slot = channel_index[channel];
+		if (slot == SKIPPED_CHANNEL) continue;
 		
-		char buf[64];
-		FrameData data;
-		for (int i = 0; i < channels.size(); i++)
-		{
-			float v;
-			sscanf(channels[i].c_str(), "%f", &v);
-			data.push_back(v);
-		}
+		float v = slot == CONSTANT_CHANNEL ? channel_constant[channel] : frame_data[slot];
+		ofxBvhJoint::CHANNEL t = layout[channel];
 		
-		frames.push_back(data);
-		
-		index++;
+		if (t == ofxBvhJoint::X_ROTATION)
+			rotate = ofQuaternion(v, ofVec3f(1, 0, 0)) * rotate;
+		else if (t == ofxBvhJoint::Y_ROTATION)
+			rotate = ofQuaternion(v, ofVec3f(0, 1, 0)) * rotate;
+		else if (t == ofxBvhJoint::Z_ROTATION)
+			rotate = ofQuaternion(v, ofVec3f(0, 0, 1)) * rotate;
 	}
 	
-	if (num_frames != frames.size())
-		ofLogWarning("ofxBvh", "frame size mismatch");
+	return rotate;
+}
+
+void ofxBvh::readFrame(int index, float *dst)
+{
+	const float *frame = getPoseFrame(index);
+	
+	for (int c = 0; c < total_channels; c++)
+	{
+		int slot = channel_index[c];
+		dst[c] = slot >= 0 ? frame[slot] : channel_constant[c];
+	}
+}
+
+size_t ofxBvh::getMemoryUsage()
+{
+	updateLoader();
+	
+	size_t bytes = sizeof(ofxBvh);
+	
+	bytes += frames.capacity() * sizeof(float);
+	bytes += decoded_frame.capacity() * sizeof(float);
+	bytes += (local_offsets.capacity() + global_positions.capacity()) * sizeof(ofVec3f)
+		+ (local_rotations.capacity() + global_rotations.capacity()) * sizeof(ofQuaternion);
+	bytes += (local_matrices.capacity() + global_matrices.capacity()) * sizeof(ofMatrix4x4);
+	bytes += channel_index.capacity() * sizeof(int) + channel_constant.capacity() * sizeof(float);
+	bytes += rotations.capacity() * sizeof(ofQuaternion) + rotations_ready.capacity();
+	
+	if (compressed_motion)
+		bytes += compressed_motion->getMemoryUsage();
+	
+	if (bake_job)
+		bytes += (size_t)bake_job->num_frames * bake_job->num_joints * (sizeof(ofQuaternion) + sizeof(ofVec3f));
+	
+	// the skeleton is shared between takes and not charged to any of them
+	for (int i = 0; i < joints.size(); i++)
+		bytes += sizeof(ofxBvhJoint) + joints[i]->children.capacity() * sizeof(ofxBvhJoint*);
+	
+	return bytes;
 }
 
 const ofxBvhJoint* ofxBvh::getJoint(int index)
@@ -430,7 +2475,8 @@ const ofxBvhJoint* ofxBvh::getJoint(int index)
 
 const ofxBvhJoint* ofxBvh::getJoint(string name)
 {
-	return jointMap[name];
+	int index = skeleton ? skeleton->findJoint(name) : -1;
+	return index < 0 ? NULL : joints[index];
 }
 
 static inline void billboard()
@@ -461,4 +2507,128 @@ static inline void billboard()
 	m[6] = m[8] * m[1] - m[9] * m[0];
 	
 	glLoadMatrixf(m);
-}
\ No newline at end of file
+}
+// takes with the same hierarchy share one skeleton
+
+static ofMutex shared_mutex;
+static vector<ofPtr<const ofxBvhSkeleton> > shared_skeletons;
+
+int ofxBvhSkeleton::addJoint(const string& name, int parent)
+{
+	Joint joint;
+	joint.name = name;
+	joint.parent = parent;
+	
+	joints.push_back(joint);
+	jointMap[name] = joints.size() - 1;
+	
+	return joints.size() - 1;
+}
+
+void ofxBvhSkeleton::flatten()
+{
+	parents.clear();
+	first_channels.clear();
+	channel_counts.clear();
+	rest_offsets.clear();
+	channel_layout.clear();
+	layouts.clear();
+	
+	for (int i = 0; i < joints.size(); i++)
+	{
+		Joint &o = joints[i];
+		o.first_channel = channel_layout.size();
+		
+		parents.push_back(o.parent);
+		first_channels.push_back(o.first_channel);
+		channel_counts.push_back(o.channels.size());
+		rest_offsets.push_back(o.offset);
+		channel_layout.insert(channel_layout.end(), o.channels.begin(), o.channels.end());
+		layouts.push_back(classify(o.channels));
+	}
+}
+
+ofxBvhSkeleton::Layout ofxBvhSkeleton::classify(const vector<ofxBvhJoint::CHANNEL>& channels)
+{
+	int offset = 0;
+	
+	if (channels.size() == 6)
+	{
+		if (channels[0] != ofxBvhJoint::X_POSITION
+			|| channels[1] != ofxBvhJoint::Y_POSITION
+			|| channels[2] != ofxBvhJoint::Z_POSITION)
+			return LAYOUT_GENERIC;
+		
+		offset = 3;
+	}
+	else if (channels.size() != 3)
+	{
+		return LAYOUT_GENERIC;
+	}
+	
+	// rotation channels are 0, 1 and 2, each one exactly once
+	const int a = channels[offset], b = channels[offset + 1], c = channels[offset + 2];
+	if (a > ofxBvhJoint::Z_ROTATION || b > ofxBvhJoint::Z_ROTATION || c > ofxBvhJoint::Z_ROTATION
+		|| a == b || b == c || a == c)
+		return LAYOUT_GENERIC;
+	
+	// XYZ XZY YXZ YZX ZXY ZYX
+	const int order = a * 2 + (b > c ? 1 : 0);
+	return (Layout)((offset ? LAYOUT_POSITION_XYZ : LAYOUT_XYZ) + order);
+}
+
+int ofxBvhSkeleton::findJoint(const string& name) const
+{
+	map<string, int>::const_iterator it = jointMap.find(name);
+	return it == jointMap.end() ? -1 : it->second;
+}
+
+bool ofxBvhSkeleton::isSameAs(const ofxBvhSkeleton& other) const
+{
+	if (total_channels != other.total_channels
+		|| joints.size() != other.joints.size())
+		return false;
+	
+	for (int i = 0; i < joints.size(); i++)
+	{
+		const Joint &a = joints[i];
+		const Joint &b = other.joints[i];
+		
+		if (a.parent != b.parent
+			|| a.offset != b.offset
+			|| a.channels != b.channels
+			|| a.name != b.name)
+			return false;
+	}
+	
+	return true;
+}
+
+ofPtr<const ofxBvhSkeleton> ofxBvhSkeleton::share(const ofxBvhSkeleton& skeleton)
+{
+	ofMutex::ScopedLock lock(shared_mutex);
+	
+	for (int i = 0; i < shared_skeletons.size(); i++)
+	{
+		if (shared_skeletons[i].use_count() == 1)
+		{
+			shared_skeletons.erase(shared_skeletons.begin() + i--);
+			continue;
+		}
+		
+		if (shared_skeletons[i]->isSameAs(skeleton))
+			return shared_skeletons[i];
+	}
+	
+	ofxBvhSkeleton *o = new ofxBvhSkeleton(skeleton);
+	o->flatten();
+	
+	shared_skeletons.push_back(ofPtr<const ofxBvhSkeleton>(o));
+	return shared_skeletons.back();
+}
+
+int ofxBvhSkeleton::getNumShared()
+{
+	ofMutex::ScopedLock lock(shared_mutex);
+	return shared_skeletons.size();
+}
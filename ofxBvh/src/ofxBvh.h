@@ -2,7 +2,12 @@
 
 #include "ofMain.h"
 
+#include "ofxBvhWorkerPool.h"
+#include "ofxBvhClock.h"
+#include "ofxBvhCompressedMotion.h"
+
 class ofxBvh;
+class ofxBvhSkeleton;
 
 class ofxBvhJoint
 {
@@ -16,16 +21,21 @@ public:
 		X_POSITION, Y_POSITION, Z_POSITION
 	};
 	
-	ofxBvhJoint(string name, ofxBvhJoint *parent) : name(name),  parent(parent) {}
+	ofxBvhJoint(const ofxBvhSkeleton *skeleton, int index, ofxBvhJoint *parent)
+		: skeleton(skeleton), index(index), parent(parent) {}
+	
+	inline const string& getName() const;
+	inline const ofVec3f& getOffset() const;
 	
-	inline const string& getName() const { return name; }
-	inline const ofVec3f& getOffset() const { return offset; }
+	inline int getIndex() const { return index; }
 	
-	inline const ofMatrix4x4& getMatrix() const { return matrix; }
-	inline const ofMatrix4x4& getGlobalMatrix() const { return global_matrix; }
+	// read from the pose arrays of the owning ofxBvh. the pose is kept as
+	// rotation and translation, the matrices are built when asked for.
+	inline const ofMatrix4x4& getMatrix() const;
+	inline const ofMatrix4x4& getGlobalMatrix() const;
 	
-	inline ofVec3f getPosition() const { return global_matrix.getTranslation(); }
-	inline ofQuaternion getRotate() const { return global_matrix.getRotate(); }
+	inline const ofVec3f& getPosition() const;
+	inline const ofQuaternion& getRotate() const;
 	
 	inline ofxBvhJoint* getParent() const { return parent; }
 	inline const vector<ofxBvhJoint*>& getChildren() const { return children; }
@@ -37,36 +47,293 @@ public:
 	
 protected:
 
-	string name;
-	ofVec3f initial_offset;
-	ofVec3f offset;
-	
-	ofMatrix4x4 matrix;
-	ofMatrix4x4 global_matrix;
+	// name, rest offset and channels live in the shared skeleton, the
+	// pose in the owning ofxBvh
+	const ofxBvhSkeleton *skeleton;
+	int index;
 	
 	ofxBvh* bvh;
 	
 	vector<ofxBvhJoint*> children;
 	ofxBvhJoint* parent;
+};
+
+// immutable description of a hierarchy: joint names, rest offsets and
+// channels. takes with identical hierarchies share one instance and only
+// keep their motion and pose state to themselves.
+
+class ofxBvhSkeleton
+{
+	friend class ofxBvh;
+	
+public:
+	
+	struct Joint
+	{
+		string name;
+		int parent;
+		ofVec3f offset;
+		vector<ofxBvhJoint::CHANNEL> channels;
+		int first_channel;	// of this joint in a frame
+	};
+	
+	// channel layouts with a dedicated kernel, named by rotation order.
+	// anything else goes through the generic per channel path.
+	enum Layout
+	{
+		LAYOUT_GENERIC,
+		LAYOUT_XYZ, LAYOUT_XZY, LAYOUT_YXZ, LAYOUT_YZX, LAYOUT_ZXY, LAYOUT_ZYX,
+		// Xposition Yposition Zposition followed by the rotations
+		LAYOUT_POSITION_XYZ, LAYOUT_POSITION_XZY, LAYOUT_POSITION_YXZ,
+		LAYOUT_POSITION_YZX, LAYOUT_POSITION_ZXY, LAYOUT_POSITION_ZYX
+	};
+	
+	ofxBvhSkeleton() : total_channels(0) {}
+	
+	int getNumJoints() const { return joints.size(); }
+	const Joint& getJoint(int index) const { return joints[index]; }
 	
-	vector<CHANNEL> channel_type;
+	// -1 if there is no joint by that name. end sites are all named "Site",
+	// the last one wins.
+	int findJoint(const string& name) const;
+	
+	int getNumChannels() const { return total_channels; }
+	
+	bool isSameAs(const ofxBvhSkeleton& other) const;
+	
+	// the joints as flat arrays in file order, a parent always comes
+	// before its children so one pass in order evaluates a pose
+	const vector<int>& getParents() const { return parents; }
+	const vector<int>& getFirstChannels() const { return first_channels; }
+	const vector<int>& getChannelCounts() const { return channel_counts; }
+	const vector<ofVec3f>& getRestOffsets() const { return rest_offsets; }
+	const vector<ofxBvhJoint::CHANNEL>& getChannelLayout() const { return channel_layout; }
+	const vector<Layout>& getLayouts() const { return layouts; }
+	
+	// the registered skeleton identical to this one, registering it if
+	// there is none yet. skeletons no take uses any more are dropped.
+	static ofPtr<const ofxBvhSkeleton> share(const ofxBvhSkeleton& skeleton);
+	static int getNumShared();
+	
+protected:
+	
+	vector<Joint> joints;
+	map<string, int> jointMap;
+	int total_channels;
+	
+	vector<int> parents;
+	vector<int> first_channels;
+	vector<int> channel_counts;
+	vector<ofVec3f> rest_offsets;
+	vector<ofxBvhJoint::CHANNEL> channel_layout;
+	vector<Layout> layouts;
+	
+	static Layout classify(const vector<ofxBvhJoint::CHANNEL>& channels);
+	
+	int addJoint(const string& name, int parent);
+	void flatten();
+};
+
+inline const string& ofxBvhJoint::getName() const { return skeleton->getJoint(index).name; }
+
+// hands out 16 byte aligned blocks so frames can be read with aligned loads
+template <typename T, int Alignment = 16>
+class ofxBvhAlignedAllocator : public std::allocator<T>
+{
+public:
+	
+	template <typename U> struct rebind { typedef ofxBvhAlignedAllocator<U, Alignment> other; };
+	
+	ofxBvhAlignedAllocator() {}
+	ofxBvhAlignedAllocator(const ofxBvhAlignedAllocator&) : std::allocator<T>() {}
+	template <typename U> ofxBvhAlignedAllocator(const ofxBvhAlignedAllocator<U, Alignment>&) {}
+	
+	T* allocate(size_t n, const void* = 0)
+	{
+		// the distance back to the real block is kept in the byte before
+		char *block = (char*)::operator new(n * sizeof(T) + Alignment);
+		char *p = block + Alignment - (size_t)block % Alignment;
+		p[-1] = (char)(p - block);
+		return (T*)p;
+	}
+	
+	void deallocate(T *p, size_t)
+	{
+		char *c = (char*)p;
+		::operator delete(c - (unsigned char)c[-1]);
+	}
+};
+
+// a pose sampled by ofxBvh::evaluate(), owned by the caller. allocate()
+// once for a take, evaluating into it allocates nothing.
+class ofxBvhPoseBuffer
+{
+	friend class ofxBvh;
+	
+public:
+	
+	ofxBvhPoseBuffer() : time(0) {}
+	
+	void allocate(const ofxBvh& bvh);
+	
+	int getNumJoints() const { return positions.size(); }
+	float getTime() const { return time; }
+	
+	const ofVec3f& getPosition(int joint) const { return positions[joint]; }
+	const ofQuaternion& getRotate(int joint) const { return rotations[joint]; }
+	ofMatrix4x4 getGlobalMatrix(int joint) const;
+	
+	size_t getMemoryUsage() const;
+	
+protected:
+	
+	ofPtr<const ofxBvhSkeleton> skeleton;
+	vector<ofVec3f> positions;
+	vector<ofQuaternion> rotations;
+	
+	// the two frames around the time, decoded for a compressed take
+	vector<float> frame_data;
+	
+	float time;
 };
 
 class ofxBvh
 {
+	friend class ofxBvhJoint;
+	friend class ofxBvhPoseBuffer;
+	friend class ofxBvhCatalog;
+	friend class ofxBvhMotionFeatures;
+	friend class ofxBvhPoseBatch;
+	friend class ofxBvhGroup;
+	friend class ofxBvhPlayer;
+	friend class ofxBvhStepper;
+	
 public:
 	
-	ofxBvh() : root(NULL), total_channels(0), rate(1), loop(false),
-		playing(false), play_head(0), need_update(false) {}
+	enum LoadMode
+	{
+		LOAD_BUFFERED,	// read the whole file into an ofBuffer
+		LOAD_MAPPED		// parse straight from a read-only memory mapping
+	};
+	
+	enum RotationCache
+	{
+		ROTATION_CACHE_NONE,	// rotations built from the euler channels on every update
+		ROTATION_CACHE_LOAD,	// one quaternion per joint and frame, built at load
+		ROTATION_CACHE_LAZY		// built the first time a frame is shown, then kept
+	};
+	
+	// what listeners get for the frames an update() passes over
+	enum CatchUp
+	{
+		CATCH_UP_NONE,			// nothing, only the frame playback lands on
+		CATCH_UP_FRAMES,		// each frame passed over, in the order of play
+		CATCH_UP_INTERPOLATED	// as many poses, evenly spaced in time and slerped
+	};
+	
+	// the joints hold the pose while it is called, on the thread calling
+	// update(). time is the take time of the pose.
+	class Listener
+	{
+	public:
+		
+		virtual ~Listener() {}
+		
+		virtual void newPose(ofxBvh& bvh, float time) = 0;
+	};
+	
+	ofxBvh() : total_channels(0), frame_stride(0), compressed(false), decoded_index(-1),
+		num_folded_channels(0), rotation_cache(ROTATION_CACHE_NONE), use_kernels(true), num_rotation_slots(0),
+		root(NULL), pose_index(-1), rate(1), playing(false), play_head(0), clock(NULL),
+		loop(false), need_update(false), catch_up(CATCH_UP_NONE), max_catch_up(120),
+		num_skipped(0), skip_from(0), skip_head(0), skip_span(0), total_skipped(0), num_drops(0),
+		max_skipped(0), load_mode(LOAD_MAPPED), cache_enabled(true), loaded_from_cache(false),
+		progressive(false), num_loaded_frames(0), load_threads(0), frame_index(0),
+		current_index(-1) {}
 	
 	virtual ~ofxBvh();
 	
+	// unload()s the previous take first, playback settings included
 	void load(string path);
 	void unload();
+	
+	// loads on the shared worker pool and swaps the take in on the first
+	// update() / isLoading() after it is done
+	void loadAsync(string path);
+	
+	void setLoadMode(LoadMode mode) { load_mode = mode; }
+	LoadMode getLoadMode() const { return load_mode; }
+	
+	// binary motion cache (.bvhc) written next to the source file. load()
+	// prefers a cache whose source size and modification time still match.
+	void setCacheEnabled(bool yn) { cache_enabled = yn; }
+	bool isCacheEnabled() const { return cache_enabled; }
+	
+	bool saveCache();
+	bool isLoadedFromCache() const { return loaded_from_cache; }
+	
+	static string getCachePath(const string& path);
+	
+	// progressive loading returns from load() once the hierarchy and the
+	// first frames are in, the rest of MOTION is parsed on a thread and
+	// frames become playable as they are published. don't copy an ofxBvh
+	// while it is still loading.
+	void setProgressive(bool yn) { progressive = yn; }
+	bool isProgressive() const { return progressive; }
+	
+	bool isLoading();
+	void waitForLoad();
+	
+	int getNumFrames();
+	int getNumLoadedFrames();
+	
+	// threads used to parse large MOTION sections, 0 uses every core
+	void setLoadThreads(int num) { load_threads = num; }
+	int getLoadThreads() const { return load_threads; }
+	
+	// keeps motion 16 bit quantized and key/delta encoded once loaded and
+	// decodes only the frame being shown. see ofxBvhCompressedMotion.
+	void setCompressed(bool yn);
+	bool isCompressed() const { return compressed; }
+	
+	float getCompressionRatio() const;
+	float getCompressionError() const;
+	
+	// channels that hold one value for the whole take are stored once and
+	// skipped by update(), this many were found by the last load()
+	int getNumFoldedChannels() const { return num_folded_channels; }
+	
+	// trades memory for the trig of the euler channels, worth it for
+	// scrubbing and reverse playback that revisit frames
+	void setRotationCache(RotationCache mode);
+	RotationCache getRotationCache() const { return rotation_cache; }
+	
+	// off sends every joint through the generic per channel path instead
+	// of its rotation order kernel, for comparison. the pose is the same.
+	void setUseKernels(bool yn) { use_kernels = yn; }
+	bool getUseKernels() const { return use_kernels; }
+	
+	// stores the global transform of every joint in every frame on the shared
+	// worker pool, after which a frame change copies the pose instead of
+	// running FK. frames not baked yet are evaluated live. don't copy an
+	// ofxBvh while it is baking.
+	bool bake();
+	void clearBake();
+	
+	bool isBaking();
+	bool isBaked();
+	float getBakeProgress();
+	
+	// bytes bake() will allocate for the loaded take
+	size_t getBakeMemoryEstimate();
 
 	void update();
 	void draw();
 	
+	// update() by an explicit time step instead of the last frame time, for
+	// fixed step and headless playback. see ofxBvhStepper.
+	void advance(float dt);
+	
 	bool isFrameNew();
 	
 	void play();
@@ -77,6 +344,39 @@ public:
 	bool isLoop();
 	
 	void setRate(float rate);
+	
+	// update() takes the time from the clock instead of advancing by the
+	// frame time, playing or not. NULL goes back, the clock must outlive
+	// the take.
+	void setClock(ofxBvhClock *clock) { this->clock = clock; }
+	ofxBvhClock* getClock() const { return clock; }
+	
+	// listeners get every frame update() shows, and with a catch up mode
+	// also the ones it passed over first, so a tracker sampling joints
+	// misses nothing when a render frame runs long
+	//
+	//	bvh.addListener(this);	// newPose(ofxBvh&, float) reads the joints
+	//	bvh.setCatchUp(ofxBvh::CATCH_UP_FRAMES);
+	void addListener(Listener *listener);
+	void removeListener(Listener *listener);
+	
+	void setCatchUp(CatchUp mode) { catch_up = mode; }
+	CatchUp getCatchUp() const { return catch_up; }
+	
+	// a jump over more frames than this is a seek, neither counted nor
+	// caught up
+	void setMaxCatchUp(int num_frames) { max_catch_up = num_frames; }
+	int getMaxCatchUp() const { return max_catch_up; }
+	
+	// frames the last update() passed over without showing them
+	int getNumSkippedFrames() const { return num_skipped; }
+	
+	// since the last reset: frames skipped, updates that skipped any, and
+	// the most one update skipped
+	int getTotalSkippedFrames() const { return total_skipped; }
+	int getNumDrops() const { return num_drops; }
+	int getMaxSkippedFrames() const { return max_skipped; }
+	void resetSkipCounters();
 
 	void setFrame(int index);
 	int getFrame();
@@ -86,22 +386,136 @@ public:
 	
 	float getDuration();
 	
+	// the pose at any time, translations interpolated linearly and
+	// rotations with slerp between the frames around it. doesn't touch the
+	// playback state or the joints, so any number of threads can sample a
+	// take that is done loading and not being changed.
+	bool evaluate(float time, ofxBvhPoseBuffer& pose) const;
+	
+	// approximate heap footprint of the loaded take
+	size_t getMemoryUsage();
+	
+	ofPtr<const ofxBvhSkeleton> getSkeleton() const { return skeleton; }
+	
 	const int getNumJoints() const { return joints.size(); }
 	const ofxBvhJoint* getJoint(int index);
 	const ofxBvhJoint* getJoint(string name);
 	
+	// only these joints and their parents are evaluated when the frame
+	// changes, the others once something asks for them. without any every
+	// joint is evaluated. registrations last until the next take is loaded.
+	void addRequiredJoint(int index);
+	void addRequiredJoint(const ofxBvhJoint *joint);
+	void clearRequiredJoints();
+	
 protected:
 	
-	typedef vector<float> FrameData;
+	typedef vector<float, ofxBvhAlignedAllocator<float> > FrameBuffer;
 	
 	int total_channels;
 	
+	// every frame back to back in one aligned block, frame i starts at
+	// i * frame_stride. the stride pads total_channels to 16 bytes.
+	FrameBuffer frames;
+	int frame_stride;
+	
+	inline float* getFrameData(int index) { return &frames[(size_t)index * frame_stride]; }
+	inline const float* getFrameData(int index) const { return &frames[(size_t)index * frame_stride]; }
+	inline void resizeFrames(int num) { frames.resize((size_t)num * frame_stride); }
+	
+	int getNumStoredFrames() const;
+	
+	// replaces frames when compressed, the shown frame is decoded into
+	// decoded_frame
+	bool compressed;
+	ofPtr<const ofxBvhCompressedMotion> compressed_motion;
+	FrameBuffer decoded_frame;
+	int decoded_index;
+	
+	void applyCompression();
+	const float* getPoseFrame(int index);
+	
+	enum
+	{
+		CONSTANT_CHANNEL = -1,	// value in channel_constant
+		SKIPPED_CHANNEL = -2	// constant zero, contributes nothing
+	};
+	
+	// per skeleton channel, its slot in a stored frame or one of the above
+	vector<int> channel_index;
+	vector<float> channel_constant;
+	int num_folded_channels;
+	
+	// joints whose channels all folded away keep their local transform
+	vector<char> static_joints;
+	
+	void foldConstantChannels();
+	void readFrame(int index, float *dst);
+	
+	RotationCache rotation_cache;
+	bool use_kernels;
+	
+	// per joint, its quaternion in a frame's block of rotations or -1
+	vector<int> rotation_slots;
+	int num_rotation_slots;
+	
+	vector<ofQuaternion> rotations;
+	vector<char> rotations_ready;	// per frame
+	
+	void prepareTake();
+	void buildRotations();
+	void computeRotations(const float *frame_data, ofQuaternion *dst);
+	const ofQuaternion* getPoseRotations(int index, const float *frame_data);
+	
+	ofQuaternion getRotation(const float *frame_data, int joint_index) const;
+	ofVec3f getTranslation(const float *frame_data, int joint_index) const;
+	inline float getChannelValue(const float *frame_data, int channel) const;
+	
+	ofPtr<const ofxBvhSkeleton> skeleton;
+	
 	ofxBvhJoint* root;
 	vector<ofxBvhJoint*> joints;
-	map<string, ofxBvhJoint*> jointMap;
 	
-	vector<FrameData> frames;
-	FrameData currentFrame;
+	// the pose, one entry per joint in skeleton order
+	vector<ofVec3f> local_offsets;
+	vector<ofQuaternion> local_rotations;
+	vector<ofVec3f> global_positions;
+	vector<ofQuaternion> global_rotations;
+	
+	// built from the pose on request, allocated the first time
+	vector<ofMatrix4x4> local_matrices;
+	vector<ofMatrix4x4> global_matrices;
+	
+	// frame of the pose. joints left out by a partial evaluation, and the
+	// local transforms of a baked pose, are brought up to date when a joint
+	// asks for them.
+	int pose_index;
+	
+	enum
+	{
+		LOCAL_DIRTY = 1,
+		GLOBAL_DIRTY = 2,
+		LOCAL_MATRIX_DIRTY = 4,
+		GLOBAL_MATRIX_DIRTY = 8
+	};
+	
+	vector<char> dirty_joints;
+	vector<char> required_joints;	// empty evaluates every joint
+	
+	inline void updateLocal(int joint) { if (dirty_joints[joint] & LOCAL_DIRTY) evaluateLocal(joint); }
+	inline void updateGlobal(int joint) { if (dirty_joints[joint] & GLOBAL_DIRTY) evaluateGlobal(joint); }
+	
+	void evaluateLocal(int joint);
+	void evaluateGlobal(int joint);
+	
+	const ofMatrix4x4& getLocalMatrix(int joint);
+	const ofMatrix4x4& getGlobalMatrix(int joint);
+	
+	class BakeJob;
+	ofPtr<BakeJob> bake_job;
+	
+	// FK on the worker, touches nothing the main thread writes
+	void computeGlobals(int index, float *frame_buffer, ofQuaternion *rotations, ofVec3f *positions);
 	
 	int num_frames;
 	float frame_time;
@@ -110,15 +524,100 @@ protected:
 	
 	bool playing;
 	float play_head;
+	ofxBvhClock *clock;
 	
 	bool loop;
 	bool need_update;
 	bool frame_new;
 	
-	void parseHierarchy(const string& data);
-	ofxBvhJoint* parseJoint(int& index, vector<string> &tokens, ofxBvhJoint *parent);
-	void updateJoint(int& index, const FrameData& frame_data, ofxBvhJoint *joint);
+	vector<Listener*> listeners;
+	CatchUp catch_up;
+	int max_catch_up;
+	
+	// the frames passed over by the last updatePlayback(), num_skipped of
+	// them after skip_from in the direction of play, and the play head
+	// before and the distance it moved for interpolation
+	int num_skipped;
+	int skip_from;
+	float skip_head;
+	float skip_span;
+	
+	int total_skipped;
+	int num_drops;
+	int max_skipped;
+	
+	ofxBvhPoseBuffer catch_up_pose;
+	
+	LoadMode load_mode;
+	
+	string source_path;
+	bool cache_enabled;
+	bool loaded_from_cache;
+	
+	bool progressive;
+	int num_loaded_frames;
+	int load_threads;
 	
-	void parseMotion(const string& data);
+	int frame_index;
+	int current_index;
 	
-};
\ No newline at end of file
+	struct Tokenizer;
+	struct MotionSource;
+	class MotionLoader;
+	class LoadJob;
+	
+	ofPtr<MotionLoader> loader;
+	ofPtr<LoadJob> load_job;
+	
+	ofPtr<MotionSource> openSource(const string& path);
+	
+	bool loadText(const string& path);
+	bool loadHeader(const string& path);
+	bool loadCache(const string& path);
+	bool writeCache(int num_frames);
+	
+	void updateLoader();
+	void stopLoader();
+	void swapTake(ofxBvh& other);
+	void selectFrame(int index);
+	
+	void setSkeleton(const ofxBvhSkeleton& desc);
+	
+	void parseHierarchy(const char *begin, const char *end);
+	int parseJoint(Tokenizer& tokens, ofxBvhSkeleton& desc, int parent);
+	// the playback part of advance(), true when current_index needs
+	// evaluateFrame()
+	bool updatePlayback(float dt);
+	
+	// runs FK for any frame, the joints hold that pose until the next one
+	void evaluateFrame(int index);
+	
+	// counts the frames between the last and the new play head
+	void countSkipped(int last_index, float last_head);
+	
+	// passes the skipped frames to the listeners, before the new one is
+	// evaluated. then notifyListeners() for that one.
+	void catchUp();
+	void notifyListeners();
+	
+	// the joints take a sampled pose, locals recovered from the globals
+	void applyPose(const ofxBvhPoseBuffer& pose);
+	
+	// evaluate() with the looping of a player instead of the take's
+	bool evaluate(float time, bool looping, ofxBvhPoseBuffer& pose) const;
+	
+	static void drawJoint(bool root, int num_children, const ofMatrix4x4& global_matrix);
+	
+	void updateLocalTransform(int joint, const float *frame_data, const ofQuaternion *rotation);
+	
+	const char* parseMotionHeader(const char *begin, const char *end);
+	void parseMotion(const char *begin, const char *end);
+	void parseMotionParallel(const char *begin, const char *end, int num_threads);
+	
+};
+
+inline const ofVec3f& ofxBvhJoint::getOffset() const { bvh->updateLocal(index); return bvh->local_offsets[index]; }
+inline const ofVec3f& ofxBvhJoint::getPosition() const { bvh->updateGlobal(index); return bvh->global_positions[index]; }
+inline const ofQuaternion& ofxBvhJoint::getRotate() const { bvh->updateGlobal(index); return bvh->global_rotations[index]; }
+inline const ofMatrix4x4& ofxBvhJoint::getMatrix() const { return bvh->getLocalMatrix(index); }
+inline const ofMatrix4x4& ofxBvhJoint::getGlobalMatrix() const { return bvh->getGlobalMatrix(index); }
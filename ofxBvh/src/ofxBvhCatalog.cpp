@@ -0,0 +1,175 @@
+#include "ofxBvhCatalog.h"
+
+class ofxBvhCatalog::ScanJob : public ofxBvhWorkerPool::Task
+{
+public:
+	
+	string path;
+	
+	Entry entry;
+	bool ok;
+	
+	ScanJob() : ok(false) {}
+	
+protected:
+	
+	void run()
+	{
+		ok = readEntry(path, entry);
+	}
+};
+
+bool ofxBvhCatalog::Entry::hasJoint(const string& joint_name) const
+{
+	return std::find(joint_names.begin(), joint_names.end(), joint_name) != joint_names.end();
+}
+
+bool ofxBvhCatalog::Entry::hasSameHierarchy(const Entry& other) const
+{
+	return joint_names == other.joint_names
+		&& joint_parents == other.joint_parents
+		&& num_channels == other.num_channels;
+}
+
+int ofxBvhCatalog::scan(string dir)
+{
+	ofDirectory directory;
+	directory.allowExt("bvh");
+	directory.listDir(dir);
+	
+	vector<ofPtr<ofxBvhWorkerPool::Task> > tasks;
+	vector<ofPtr<ScanJob> > jobs;
+	
+	for (int i = 0; i < directory.numFiles(); i++)
+	{
+		ofPtr<ScanJob> job(new ScanJob);
+		job->path = directory.getPath(i);
+		
+		jobs.push_back(job);
+		tasks.push_back(job);
+		
+		ofxBvhWorkerPool::getShared().start(job);
+	}
+	
+	ofxBvhWorkerPool::getShared().wait(tasks);
+	
+	int n = 0;
+	
+	for (int i = 0; i < jobs.size(); i++)
+	{
+		if (jobs[i]->ok)
+		{
+			addEntry(jobs[i]->entry);
+			n++;
+		}
+	}
+	
+	return n;
+}
+
+bool ofxBvhCatalog::add(string path)
+{
+	Entry entry;
+	
+	if (!readEntry(path, entry))
+		return false;
+	
+	addEntry(entry);
+	return true;
+}
+
+void ofxBvhCatalog::clear()
+{
+	entries.clear();
+	nameMap.clear();
+	pathMap.clear();
+}
+
+const ofxBvhCatalog::Entry* ofxBvhCatalog::find(const string& name) const
+{
+	map<string, int>::const_iterator it = nameMap.find(name);
+	if (it == nameMap.end()) return NULL;
+	
+	return &entries[it->second];
+}
+
+const ofxBvhCatalog::Entry* ofxBvhCatalog::findPath(const string& path) const
+{
+	map<string, int>::const_iterator it = pathMap.find(ofToDataPath(path));
+	if (it == pathMap.end()) return NULL;
+	
+	return &entries[it->second];
+}
+
+vector<const ofxBvhCatalog::Entry*> ofxBvhCatalog::findWithJoint(const string& joint_name) const
+{
+	vector<const Entry*> result;
+	
+	for (int i = 0; i < entries.size(); i++)
+	{
+		if (entries[i].hasJoint(joint_name))
+			result.push_back(&entries[i]);
+	}
+	
+	return result;
+}
+
+vector<const ofxBvhCatalog::Entry*> ofxBvhCatalog::findByDuration(float min_seconds, float max_seconds) const
+{
+	vector<const Entry*> result;
+	
+	for (int i = 0; i < entries.size(); i++)
+	{
+		if (ofInRange(entries[i].getDuration(), min_seconds, max_seconds))
+			result.push_back(&entries[i]);
+	}
+	
+	return result;
+}
+
+bool ofxBvhCatalog::readEntry(const string& path, Entry& entry)
+{
+	ofxBvh bvh;
+	
+	entry.path = ofToDataPath(path);
+	entry.name = ofFilePath::getBaseName(entry.path);
+	
+	if (!bvh.loadHeader(entry.path))
+		return false;
+	
+	const ofxBvhSkeleton &skeleton = *bvh.getSkeleton();
+	
+	for (int i = 0; i < skeleton.getNumJoints(); i++)
+	{
+		entry.joint_names.push_back(skeleton.getJoint(i).name);
+		entry.joint_parents.push_back(skeleton.getJoint(i).parent);
+	}
+	
+	entry.num_channels = bvh.total_channels;
+	entry.num_frames = bvh.num_frames;
+	entry.frame_time = bvh.frame_time;
+	
+	return true;
+}
+
+void ofxBvhCatalog::addEntry(const Entry& entry)
+{
+	// adding a file again refreshes its entry
+	map<string, int>::iterator it = pathMap.find(entry.path);
+	
+	if (it != pathMap.end())
+	{
+		entries[it->second] = entry;
+		return;
+	}
+	
+	it = nameMap.find(entry.name);
+	
+	if (it != nameMap.end())
+		ofLogWarning("ofxBvh", entry.path + " has the same name as " + entries[it->second].path + ", find() returns the first");
+	else
+		nameMap[entry.name] = entries.size();
+	
+	pathMap[entry.path] = entries.size();
+	entries.push_back(entry);
+}
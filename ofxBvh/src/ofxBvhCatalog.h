@@ -0,0 +1,65 @@
+#pragma once
+
+#include "ofxBvh.h"
+
+// an index of BVH takes built from HIERARCHY and the Frames: / Frame Time:
+// header only, no motion data is parsed.
+//
+//	ofxBvhCatalog catalog;
+//	catalog.scan("bvhfiles");
+//	const ofxBvhCatalog::Entry *e = catalog.find("aachan");
+
+class ofxBvhCatalog
+{
+public:
+	
+	struct Entry
+	{
+		string path;
+		string name;
+		
+		// in file order, parents come before their children
+		vector<string> joint_names;
+		vector<int> joint_parents;
+		
+		int num_channels;
+		int num_frames;
+		float frame_time;
+		
+		Entry() : num_channels(0), num_frames(0), frame_time(0) {}
+		
+		int getNumJoints() const { return joint_names.size(); }
+		float getDuration() const { return num_frames * frame_time; }
+		
+		bool hasJoint(const string& joint_name) const;
+		bool hasSameHierarchy(const Entry& other) const;
+	};
+	
+	// indexes every .bvh in dir (relative to the data folder) on the shared
+	// worker pool, returns the number of entries added
+	int scan(string dir);
+	bool add(string path);
+	void clear();
+	
+	int size() const { return entries.size(); }
+	const Entry& getEntry(int index) const { return entries.at(index); }
+	
+	// takes from different folders can share a name, find() returns the
+	// first one added. findPath() tells them apart.
+	const Entry* find(const string& name) const;
+	const Entry* findPath(const string& path) const;
+	
+	vector<const Entry*> findWithJoint(const string& joint_name) const;
+	vector<const Entry*> findByDuration(float min_seconds, float max_seconds) const;
+	
+protected:
+	
+	class ScanJob;
+	
+	vector<Entry> entries;
+	map<string, int> nameMap;
+	map<string, int> pathMap;
+	
+	static bool readEntry(const string& path, Entry& entry);
+	void addEntry(const Entry& entry);
+};
@@ -0,0 +1,160 @@
+#include "ofxBvhClock.h"
+
+ofxBvhAudioClock::ofxBvhAudioClock() : speed(1), audio_latency(0), presentation_delay(1 / 60.),
+	resync_threshold(0.25), stall_timeout(0.1), position_gain(0.05), rate_gain(0.05), time(0)
+{
+	reset();
+}
+
+void ofxBvhAudioClock::addObservation(double audio_seconds)
+{
+	addObservation(audio_seconds, getHostTime());
+}
+
+void ofxBvhAudioClock::addObservation(double audio_seconds, double host_seconds)
+{
+	ofMutex::ScopedLock lock(mutex);
+	
+	if (locked && audio_seconds == last_observed) return;
+	
+	last_observed = audio_seconds;
+	last_change = host_seconds;
+	
+	// picks up where the audio is once it moves again, not a resync
+	if (stalled)
+	{
+		stalled = false;
+		base_audio = audio_seconds;
+		base_host = host_seconds;
+		return;
+	}
+	
+	const double predicted = base_audio + (host_seconds - base_host) * ratio * applied_speed;
+	const double error = audio_seconds - predicted;
+	
+	if (!locked || fabs(error) > resync_threshold)
+	{
+		if (locked) num_resyncs++;
+		
+		locked = true;
+		base_audio = audio_seconds;
+		base_host = host_seconds;
+		return;
+	}
+	
+	// second order loop: the position takes part of the error, the rate
+	// integrates it. errors well outside the jitter come from speed changes
+	// between observations and are taken over faster. a stopped or changing
+	// speed tells nothing about the rate.
+	const bool outlier = error * error > jitter * 9 + 1e-6;
+	
+	base_audio = predicted + error * (outlier ? 0.5 : position_gain);
+	base_host = host_seconds;
+	
+	if (!speed_changed && fabs(applied_speed) > 0.1)
+		ratio = std::max(0.9, std::min(1.1, ratio + error * rate_gain / applied_speed));
+	
+	speed_changed = false;
+	jitter += (error * error - jitter) * 0.05;
+}
+
+void ofxBvhAudioClock::setSpeed(float speed)
+{
+	ofMutex::ScopedLock lock(mutex);
+	this->speed = speed;
+}
+
+void ofxBvhAudioClock::setBandwidth(float position_gain, float rate_gain)
+{
+	ofMutex::ScopedLock lock(mutex);
+	
+	this->position_gain = ofClamp(position_gain, 0, 1);
+	this->rate_gain = ofClamp(rate_gain, 0, 1);
+}
+
+void ofxBvhAudioClock::reset()
+{
+	ofMutex::ScopedLock lock(mutex);
+	
+	locked = false;
+	base_audio = 0;
+	base_host = 0;
+	ratio = 1;
+	jitter = 0;
+	last_observed = 0;
+	last_change = 0;
+	stalled = false;
+	num_resyncs = 0;
+	applied_speed = speed;
+	speed_changed = false;
+}
+
+void ofxBvhAudioClock::update()
+{
+	update(getHostTime());
+}
+
+void ofxBvhAudioClock::update(double host_seconds)
+{
+	ofMutex::ScopedLock lock(mutex);
+	
+	if (!locked) return;
+	
+	// a new speed starts with the frame it was set for
+	if (speed != applied_speed)
+	{
+		base_audio += (host_seconds - base_host) * ratio * applied_speed;
+		base_host = host_seconds;
+		
+		applied_speed = speed;
+		speed_changed = true;
+	}
+	
+	// the same position, or none at all, for too long. the audio stopped
+	// where the loop had it when the last new position came in.
+	if (!stalled && host_seconds - last_change > stall_timeout)
+	{
+		stalled = true;
+		base_audio += (last_change - base_host) * ratio * applied_speed;
+		base_host = host_seconds;
+	}
+	
+	if (stalled)
+	{
+		time = base_audio;
+		return;
+	}
+	
+	// what is heard when the frame is seen
+	const double heard = host_seconds + presentation_delay - audio_latency;
+	time = base_audio + (heard - base_host) * ratio * applied_speed;
+}
+
+double ofxBvhAudioClock::getDrift()
+{
+	ofMutex::ScopedLock lock(mutex);
+	return ratio - 1;
+}
+
+double ofxBvhAudioClock::getJitter()
+{
+	ofMutex::ScopedLock lock(mutex);
+	return sqrt(jitter);
+}
+
+bool ofxBvhAudioClock::isStalled()
+{
+	ofMutex::ScopedLock lock(mutex);
+	return stalled;
+}
+
+int ofxBvhAudioClock::getNumResyncs()
+{
+	ofMutex::ScopedLock lock(mutex);
+	return num_resyncs;
+}
+
+double ofxBvhAudioClock::getHostTime()
+{
+	return ofGetElapsedTimeMicros() * 1e-6;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "ofMain.h"
+
+// where a take's time comes from when it should follow something other
+// than ofGetLastFrameTime(). update() the clock once per frame, before the
+// takes that use it.
+
+class ofxBvhClock
+{
+public:
+	
+	virtual ~ofxBvhClock() {}
+	
+	virtual void update() = 0;
+	
+	// seconds of motion for the frame being rendered
+	virtual float getTime() const = 0;
+};
+
+// follows the sample clock of an audio track. the reported position is
+// coarse and late by a varying amount, so it is fed to a delay locked loop
+// that keeps a smoothed position and the rate of the audio clock against
+// the system clock. getTime() extrapolates that to when the frame will be
+// seen, which also carries it over stalls of the render loop.
+//
+//	clock.addObservation(track.getPosition() * track_length);
+//	clock.setSpeed(track.getSpeed());
+//	clock.update();
+//	bvh.setClock(&clock);	// once
+
+class ofxBvhAudioClock : public ofxBvhClock
+{
+public:
+	
+	ofxBvhAudioClock();
+	
+	// the audio position in seconds as just read from the player or handed
+	// to an audio callback, from any thread. a position equal to the last
+	// one is skipped, players report in blocks.
+	//
+	// no new position for longer than the stall timeout means a pause,
+	// stall or underrun the clock wasn't told about, the time then holds at
+	// the last one until it moves again. up to the timeout it runs on, so
+	// call setSpeed(0) when pausing the track to stop exactly.
+	void addObservation(double audio_seconds);
+	void addObservation(double audio_seconds, double host_seconds);
+	
+	// playback speed of the track, taken over from the next update()
+	// instead of waiting for the loop to find it
+	void setSpeed(float speed);
+	float getSpeed() const { return speed; }
+	
+	// the device plays a position this long after reporting it
+	void setAudioLatency(float seconds) { audio_latency = seconds; }
+	float getAudioLatency() const { return audio_latency; }
+	
+	// from update() to the frame reaching the screen, about a frame
+	void setPresentationDelay(float seconds) { presentation_delay = seconds; }
+	float getPresentationDelay() const { return presentation_delay; }
+	
+	// errors larger than this are seeks or loops, the clock jumps there
+	void setResyncThreshold(float seconds) { resync_threshold = seconds; }
+	
+	// longer than the player takes between two positions, 0.1 s by default
+	void setStallTimeout(float seconds) { stall_timeout = seconds; }
+	float getStallTimeout() const { return stall_timeout; }
+	bool isStalled();
+	
+	// smaller is smoother and slower to follow, 0..1
+	void setBandwidth(float position_gain, float rate_gain);
+	
+	void reset();
+	
+	void update();
+	void update(double host_seconds);
+	
+	float getTime() const { return time; }
+	
+	// audio seconds per system second over the speed, minus one
+	double getDrift();
+	
+	// rms error of the observations against the loop, seconds
+	double getJitter();
+	
+	int getNumResyncs();
+	
+	static double getHostTime();
+	
+protected:
+	
+	ofMutex mutex;
+	
+	bool locked;
+	double base_audio;
+	double base_host;
+	double ratio;
+	double jitter;
+	double last_observed;
+	double last_change;
+	bool stalled;
+	int num_resyncs;
+	
+	float speed;
+	float applied_speed;
+	bool speed_changed;
+	float audio_latency;
+	float presentation_delay;
+	float resync_threshold;
+	float stall_timeout;
+	float position_gain;
+	float rate_gain;
+	
+	float time;
+};
@@ -0,0 +1,136 @@
+#include "ofxBvhCompressedMotion.h"
+
+// offsets are read as a 32 bit window, so the buffer is padded past the end
+static const int PACKED_PADDING = 4;
+
+void ofxBvhCompressedMotion::encode(const float *frames, int num_frames, int stride, int num_channels, int key_interval)
+{
+	this->num_frames = num_frames;
+	this->num_channels = num_channels;
+	this->key_interval = key_interval = std::max(key_interval, 1);
+	
+	minimum.assign(num_channels, 0);
+	scale.assign(num_channels, 0);
+	
+	spans.clear();
+	packed.clear();
+	
+	max_error = 0;
+	
+	if (num_frames <= 0) return;
+	
+	for (int c = 0; c < num_channels; c++)
+	{
+		float lo = frames[c], hi = frames[c];
+		
+		for (int i = 1; i < num_frames; i++)
+		{
+			float v = frames[(size_t)i * stride + c];
+			lo = std::min(lo, v);
+			hi = std::max(hi, v);
+		}
+		
+		minimum[c] = lo;
+		scale[c] = (hi - lo) / 65535.0f;
+	}
+	
+	const int num_blocks = (num_frames + key_interval - 1) / key_interval;
+	spans.resize((size_t)num_blocks * num_channels);
+	
+	vector<unsigned short> q(key_interval);
+	
+	for (int b = 0; b < num_blocks; b++)
+	{
+		const int first = b * key_interval;
+		const int count = std::min(key_interval, num_frames - first);
+		
+		for (int c = 0; c < num_channels; c++)
+		{
+			Span &span = spans[(size_t)b * num_channels + c];
+			
+			unsigned short lo = 65535, hi = 0;
+			for (int j = 0; j < count; j++)
+			{
+				q[j] = quantize(frames[(size_t)(first + j) * stride + c], c);
+				lo = std::min(lo, q[j]);
+				hi = std::max(hi, q[j]);
+			}
+			
+			span.key = lo;
+			span.bits = 0;
+			span.offset = packed.size();
+			
+			while ((hi - lo) >> span.bits)
+				span.bits++;
+			
+			if (span.bits == 0) continue;
+			
+			packed.resize(span.offset + (count * span.bits + 7) / 8, 0);
+			unsigned char *dst = &packed[span.offset];
+			
+			for (int j = 0; j < count; j++)
+			{
+				unsigned int v = q[j] - lo;
+				int bit = j * span.bits;
+				
+				for (int k = 0; k < span.bits; k++, bit++)
+					if (v & (1 << k))
+						dst[bit >> 3] |= 1 << (bit & 7);
+			}
+		}
+	}
+	
+	packed.resize(packed.size() + PACKED_PADDING, 0);
+	
+	// resize leaves up to half the capacity unused
+	vector<unsigned char>(packed).swap(packed);
+	
+	vector<float> decoded(num_channels);
+	
+	for (int i = 0; i < num_frames; i++)
+	{
+		decode(i, &decoded[0]);
+		
+		for (int c = 0; c < num_channels; c++)
+			max_error = std::max(max_error, fabsf(decoded[c] - frames[(size_t)i * stride + c]));
+	}
+}
+
+void ofxBvhCompressedMotion::decode(int index, float *dst) const
+{
+	const int b = index / key_interval;
+	const int j = index - b * key_interval;
+	
+	const Span *span = &spans[(size_t)b * num_channels];
+	
+	for (int c = 0; c < num_channels; c++)
+	{
+		const Span &o = span[c];
+		unsigned int q = o.key;
+		
+		if (o.bits)
+		{
+			int bit = j * o.bits;
+			const unsigned char *p = &packed[o.offset + (bit >> 3)];
+			
+			unsigned int window = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+			q += (window >> (bit & 7)) & ((1u << o.bits) - 1);
+		}
+		
+		dst[c] = minimum[c] + q * scale[c];
+	}
+}
+
+size_t ofxBvhCompressedMotion::getMemoryUsage() const
+{
+	return sizeof(ofxBvhCompressedMotion)
+		+ (minimum.capacity() + scale.capacity()) * sizeof(float)
+		+ spans.capacity() * sizeof(Span)
+		+ packed.capacity();
+}
+
+float ofxBvhCompressedMotion::getCompressionRatio() const
+{
+	size_t bytes = getMemoryUsage();
+	return bytes ? (float)num_frames * num_channels * sizeof(float) / bytes : 1;
+}
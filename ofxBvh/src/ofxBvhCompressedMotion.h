@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ofMain.h"
+
+// motion quantized to 16 bits per channel over the range the channel
+// covers in the take, in blocks of key_interval frames. a block keeps a
+// key value per channel, the smallest in the block, and packs the offsets
+// from it with as few bits as the block needs (none for a channel that
+// holds still). any frame decodes on its own without walking the ones
+// before it.
+
+class ofxBvhCompressedMotion
+{
+public:
+	
+	ofxBvhCompressedMotion() : num_frames(0), num_channels(0), key_interval(0), max_error(0) {}
+	
+	// frame i starts at frames + i * stride
+	void encode(const float *frames, int num_frames, int stride, int num_channels, int key_interval = 32);
+	void decode(int index, float *dst) const;
+	
+	int getNumFrames() const { return num_frames; }
+	int getNumChannels() const { return num_channels; }
+	int getKeyInterval() const { return key_interval; }
+	
+	size_t getMemoryUsage() const;
+	
+	// against the same motion stored as 32 bit floats
+	float getCompressionRatio() const;
+	
+	// largest difference to the source values seen while encoding
+	float getMaxError() const { return max_error; }
+	
+protected:
+	
+	struct Span
+	{
+		unsigned short key;
+		unsigned char bits;
+		unsigned int offset;	// byte offset into packed
+	};
+	
+	int num_frames;
+	int num_channels;
+	int key_interval;
+	
+	float max_error;
+	
+	vector<float> minimum;
+	vector<float> scale;
+	
+	vector<Span> spans;	// num_channels per block
+	vector<unsigned char> packed;
+	
+	inline unsigned short quantize(float v, int channel) const
+	{
+		if (scale[channel] == 0) return 0;
+		return (unsigned short)ofClamp(floorf((v - minimum[channel]) / scale[channel] + 0.5f), 0, 65535);
+	}
+};
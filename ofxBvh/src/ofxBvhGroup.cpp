@@ -0,0 +1,245 @@
+#include "ofxBvhGroup.h"
+
+// the frame changes of one update(). threads take performers one at a time
+// until none are left; a job the pool starts after the calling thread has
+// closed the sweep returns without touching any performer, so update()
+// never waits on jobs queued behind a bake or a load.
+class ofxBvhGroup::Sweep
+{
+public:
+	
+	Sweep(const vector<ofxBvh*>& performers) : performers(performers), next(0), active(0), closed(false) {}
+	
+	bool enter()
+	{
+		ofMutex::ScopedLock lock(mutex);
+		if (closed) return false;
+		
+		active++;
+		return true;
+	}
+	
+	void run()
+	{
+		while (true)
+		{
+			mutex.lock();
+			
+			if (next == performers.size())
+			{
+				bool last = --active == 0 && closed;
+				mutex.unlock();
+				
+				if (last) idle.set();
+				return;
+			}
+			
+			ofxBvh *bvh = performers[next++];
+			mutex.unlock();
+			
+			bvh->evaluateFrame(bvh->current_index);
+		}
+	}
+	
+	// after the calling thread ran out of performers
+	void close()
+	{
+		mutex.lock();
+		closed = true;
+		bool busy = active > 0;
+		mutex.unlock();
+		
+		if (busy) idle.wait();
+	}
+	
+protected:
+	
+	const vector<ofxBvh*>& performers;
+	
+	ofMutex mutex;
+	int next;
+	int active;
+	bool closed;
+	
+	Poco::Event idle;
+};
+
+class ofxBvhGroup::SweepJob : public ofxBvhWorkerPool::Task
+{
+public:
+	
+	ofPtr<Sweep> sweep;
+	
+protected:
+	
+	void run()
+	{
+		if (sweep->enter())
+			sweep->run();
+	}
+};
+
+ofxBvh& ofxBvhGroup::add()
+{
+	ofPtr<ofxBvh> bvh(new ofxBvh);
+	performers.push_back(bvh);
+	return *bvh;
+}
+
+ofxBvh& ofxBvhGroup::add(string path)
+{
+	ofxBvh &bvh = add();
+	bvh.load(path);
+	return bvh;
+}
+
+void ofxBvhGroup::add(ofPtr<ofxBvh> bvh)
+{
+	if (!bvh)
+	{
+		ofLogError("ofxBvh", "can't add an empty performer");
+		return;
+	}
+	
+	// twice in one group it would play at double speed and be evaluated by
+	// two threads at once
+	for (int i = 0; i < performers.size(); i++)
+	{
+		if (performers[i] == bvh)
+		{
+			ofLogError("ofxBvh", "performer is already in the group");
+			return;
+		}
+	}
+	
+	performers.push_back(bvh);
+}
+
+void ofxBvhGroup::clear()
+{
+	performers.clear();
+	changed.clear();
+}
+
+void ofxBvhGroup::play()
+{
+	for (int i = 0; i < performers.size(); i++)
+		performers[i]->play();
+}
+
+void ofxBvhGroup::stop()
+{
+	for (int i = 0; i < performers.size(); i++)
+		performers[i]->stop();
+}
+
+void ofxBvhGroup::setLoop(bool yn)
+{
+	for (int i = 0; i < performers.size(); i++)
+		performers[i]->setLoop(yn);
+}
+
+void ofxBvhGroup::setRate(float rate)
+{
+	for (int i = 0; i < performers.size(); i++)
+		performers[i]->setRate(rate);
+}
+
+void ofxBvhGroup::setClock(ofxBvhClock *clock)
+{
+	for (int i = 0; i < performers.size(); i++)
+		performers[i]->setClock(clock);
+}
+
+void ofxBvhGroup::setCatchUp(ofxBvh::CatchUp mode)
+{
+	for (int i = 0; i < performers.size(); i++)
+		performers[i]->setCatchUp(mode);
+}
+
+int ofxBvhGroup::getTotalSkippedFrames() const
+{
+	int num = 0;
+	
+	for (int i = 0; i < performers.size(); i++)
+		num += performers[i]->getTotalSkippedFrames();
+	
+	return num;
+}
+
+void ofxBvhGroup::resetSkipCounters()
+{
+	for (int i = 0; i < performers.size(); i++)
+		performers[i]->resetSkipCounters();
+}
+
+void ofxBvhGroup::setPosition(float pos)
+{
+	for (int i = 0; i < performers.size(); i++)
+		performers[i]->setPosition(pos);
+}
+
+void ofxBvhGroup::setFrame(int index)
+{
+	for (int i = 0; i < performers.size(); i++)
+		performers[i]->setFrame(index);
+}
+
+void ofxBvhGroup::update()
+{
+	advance(ofGetFrameNum() > 1 ? ofGetLastFrameTime() : 0);
+}
+
+void ofxBvhGroup::advance(float dt)
+{
+	// play heads, loads and frame selection stay on this thread
+	changed.clear();
+	
+	for (int i = 0; i < performers.size(); i++)
+	{
+		if (performers[i]->updatePlayback(dt))
+			changed.push_back(performers[i].get());
+	}
+	
+	if (changed.empty()) return;
+	
+	// listeners are called on this thread, the frames passed over before
+	// the sweep and the new ones after it
+	for (int i = 0; i < changed.size(); i++)
+		changed[i]->catchUp();
+	
+	ofxBvhWorkerPool &pool = ofxBvhWorkerPool::getShared();
+	
+	int num_threads = max_threads > 0 ? max_threads : pool.getNumThreads() + 1;
+	num_threads = std::min(num_threads, (int)changed.size());
+	
+	if (num_threads <= 1)
+	{
+		for (int i = 0; i < changed.size(); i++)
+			changed[i]->evaluateFrame(changed[i]->current_index);
+	}
+	else
+	{
+		ofPtr<Sweep> sweep(new Sweep(changed));
+		
+		for (int i = 0; i < num_threads - 1; i++)
+		{
+			ofPtr<SweepJob> job(new SweepJob);
+			job->sweep = sweep;
+			pool.start(job);
+		}
+		
+		sweep->enter();
+		sweep->run();
+		sweep->close();
+	}
+	
+	for (int i = 0; i < changed.size(); i++)
+		changed[i]->notifyListeners();
+}
+
+void ofxBvhGroup::draw()
+{
+	for (int i = 0; i < performers.size(); i++)
+		performers[i]->draw();
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "ofxBvh.h"
+
+// several takes played as one. update() moves every performer to its new
+// frame on the calling thread and runs the frame changes on the shared
+// worker pool, the calling thread helping out. the poses are in place when
+// it returns.
+//
+//	ofxBvhLoader loader;
+//	loader.add(group.add(), "aachan.bvh");
+//	loader.add(group.add(), "kashiyuka.bvh");
+//	loader.waitForAll();
+//	...
+//	group.setPosition(t);
+//	group.update();
+//	group.draw();
+
+class ofxBvhGroup
+{
+public:
+	
+	ofxBvhGroup() : max_threads(0) {}
+	
+	// a new, empty performer owned by the group
+	ofxBvh& add();
+	ofxBvh& add(string path);
+	
+	// shares a take with the rest of the program. a take already in the
+	// group is rejected, each performer is advanced once per update().
+	void add(ofPtr<ofxBvh> bvh);
+	
+	void clear();
+	
+	int size() const { return performers.size(); }
+	ofxBvh& operator[](int index) { return *performers.at(index); }
+	ofxBvh& getPerformer(int index) { return *performers.at(index); }
+	
+	void play();
+	void stop();
+	void setLoop(bool yn);
+	void setRate(float rate);
+	void setClock(ofxBvhClock *clock);
+	void setCatchUp(ofxBvh::CatchUp mode);
+	
+	// frames skipped by every performer, see ofxBvh::getTotalSkippedFrames()
+	int getTotalSkippedFrames() const;
+	void resetSkipCounters();
+	
+	// the same position of every take, 0..1 of its own duration
+	void setPosition(float pos);
+	
+	// the same frame of every take
+	void setFrame(int index);
+	
+	void update();
+	void draw();
+	
+	// update() by an explicit time step, see ofxBvh::advance()
+	void advance(float dt);
+	
+	// threads update() spreads the frame changes over, 0 uses the calling
+	// thread and every worker of the shared pool, 1 only the calling thread
+	void setMaxThreads(int num) { max_threads = num; }
+	int getMaxThreads() const { return max_threads; }
+	
+protected:
+	
+	class Sweep;
+	class SweepJob;
+	
+	vector<ofPtr<ofxBvh> > performers;
+	int max_threads;
+	
+	// performers with a frame change in the current update()
+	vector<ofxBvh*> changed;
+};
@@ -0,0 +1,42 @@
+#include "ofxBvhLoader.h"
+
+void ofxBvhLoader::add(ofxBvh& bvh, string path)
+{
+	bvh.loadAsync(path);
+	targets.push_back(&bvh);
+}
+
+void ofxBvhLoader::clear()
+{
+	targets.clear();
+}
+
+bool ofxBvhLoader::isDone()
+{
+	return getNumLoaded() == targets.size();
+}
+
+void ofxBvhLoader::waitForAll()
+{
+	for (int i = 0; i < targets.size(); i++)
+		targets[i]->waitForLoad();
+}
+
+int ofxBvhLoader::getNumLoaded()
+{
+	int n = 0;
+	
+	for (int i = 0; i < targets.size(); i++)
+	{
+		if (!targets[i]->isLoading())
+			n++;
+	}
+	
+	return n;
+}
+
+float ofxBvhLoader::getProgress()
+{
+	if (targets.empty()) return 1;
+	return (float)getNumLoaded() / targets.size();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "ofxBvh.h"
+
+// loads a set of takes concurrently on the shared worker pool
+//
+//	ofxBvhLoader loader;
+//	loader.add(bvh[0], "aachan.bvh");
+//	loader.add(bvh[1], "kashiyuka.bvh");
+//	loader.waitForAll();
+//
+// the ofxBvh objects must stay where they are until the loader is done.
+
+class ofxBvhLoader
+{
+public:
+	
+	void add(ofxBvh& bvh, string path);
+	void clear();
+	
+	bool isDone();
+	void waitForAll();
+	
+	int getNumFiles() const { return targets.size(); }
+	int getNumLoaded();
+	float getProgress();
+	
+protected:
+	
+	vector<ofxBvh*> targets;
+};
@@ -0,0 +1,197 @@
+#include "ofxBvhMotionFeatures.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define OFX_BVH_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+void ofxBvhMotionFeatures::build(ofxBvh& bvh)
+{
+	clear();
+	
+	bvh.waitForLoad();
+	
+	num_frames = bvh.getNumFrames();
+	num_joints = bvh.getNumJoints();
+	frame_time = bvh.frame_time;
+	
+	if (num_frames == 0 || num_joints == 0)
+	{
+		clear();
+		return;
+	}
+	
+	column_size = (num_frames + 3) & ~3;
+	
+	const size_t size = (size_t)num_joints * column_size;
+	positions.assign(size * 3, 0);
+	velocities.assign(size * 3, 0);
+	accelerations.assign(size * 3, 0);
+	speeds.assign(size, 0);
+	turnings.assign(size, 0);
+	
+	for (int i = 0; i < num_frames; i++)
+	{
+		bvh.evaluateFrame(i);
+		
+		for (int j = 0; j < num_joints; j++)
+		{
+			const ofVec3f p = bvh.joints[j]->getPosition();
+			
+			positions[(size_t)(j * 3 + 0) * column_size + i] = p.x;
+			positions[(size_t)(j * 3 + 1) * column_size + i] = p.y;
+			positions[(size_t)(j * 3 + 2) * column_size + i] = p.z;
+		}
+	}
+	
+	// put back the pose of the frame being shown
+	if (bvh.current_index >= 0)
+		bvh.evaluateFrame(bvh.current_index);
+	
+	for (int j = 0; j < num_joints; j++)
+		computeDerivatives(j);
+}
+
+void ofxBvhMotionFeatures::clear()
+{
+	num_frames = 0;
+	num_joints = 0;
+	column_size = 0;
+	frame_time = 0;
+	
+	positions.clear();
+	velocities.clear();
+	accelerations.clear();
+	speeds.clear();
+	turnings.clear();
+}
+
+const float* ofxBvhMotionFeatures::column(Feature feature, int joint, int axis) const
+{
+	switch (feature)
+	{
+		case POSITION: return &positions[(size_t)(joint * 3 + axis) * column_size];
+		case VELOCITY: return &velocities[(size_t)(joint * 3 + axis) * column_size];
+		case ACCELERATION: return &accelerations[(size_t)(joint * 3 + axis) * column_size];
+		case SPEED: return &speeds[(size_t)joint * column_size];
+		case TURNING: return &turnings[(size_t)joint * column_size];
+	}
+	
+	return NULL;
+}
+
+// one interior frame, the sse path below does the same operations in the
+// same order four frames at a time
+static inline void computeFrame(const float *px, const float *py, const float *pz, int i,
+								float inv_2dt, float inv_dt2,
+								float *vx, float *vy, float *vz,
+								float *ax, float *ay, float *az,
+								float *speed, float *turning_cos)
+{
+	float d0x = px[i] - px[i - 1], d1x = px[i + 1] - px[i];
+	float d0y = py[i] - py[i - 1], d1y = py[i + 1] - py[i];
+	float d0z = pz[i] - pz[i - 1], d1z = pz[i + 1] - pz[i];
+	
+	vx[i] = (px[i + 1] - px[i - 1]) * inv_2dt;
+	vy[i] = (py[i + 1] - py[i - 1]) * inv_2dt;
+	vz[i] = (pz[i + 1] - pz[i - 1]) * inv_2dt;
+	
+	ax[i] = (d1x - d0x) * inv_dt2;
+	ay[i] = (d1y - d0y) * inv_dt2;
+	az[i] = (d1z - d0z) * inv_dt2;
+	
+	speed[i] = sqrtf(vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i]);
+	
+	float dot = d0x * d1x + d0y * d1y + d0z * d1z;
+	float len = sqrtf((d0x * d0x + d0y * d0y + d0z * d0z) * (d1x * d1x + d1y * d1y + d1z * d1z));
+	
+	turning_cos[i] = len > 0 ? dot / len : 1;
+}
+
+void ofxBvhMotionFeatures::computeDerivatives(int joint)
+{
+	const float *px = column(POSITION, joint, 0);
+	const float *py = column(POSITION, joint, 1);
+	const float *pz = column(POSITION, joint, 2);
+	
+	float *vx = column(VELOCITY, joint, 0);
+	float *vy = column(VELOCITY, joint, 1);
+	float *vz = column(VELOCITY, joint, 2);
+	
+	float *ax = column(ACCELERATION, joint, 0);
+	float *ay = column(ACCELERATION, joint, 1);
+	float *az = column(ACCELERATION, joint, 2);
+	
+	float *speed = column(SPEED, joint, 0);
+	float *turning = column(TURNING, joint, 0);
+	
+	// needs a frame on each side
+	if (num_frames < 3) return;
+	
+	const float inv_2dt = frame_time > 0 ? 0.5f / frame_time : 0;
+	const float inv_dt2 = frame_time > 0 ? 1.0f / (frame_time * frame_time) : 0;
+	
+	int i = 1;
+	
+#ifdef OFX_BVH_USE_SSE
+	const __m128 v_inv_2dt = _mm_set1_ps(inv_2dt);
+	const __m128 v_inv_dt2 = _mm_set1_ps(inv_dt2);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1);
+	
+	for (; i + 4 <= num_frames - 1; i += 4)
+	{
+		__m128 pxp = _mm_loadu_ps(px + i - 1), pxc = _mm_loadu_ps(px + i), pxn = _mm_loadu_ps(px + i + 1);
+		__m128 pyp = _mm_loadu_ps(py + i - 1), pyc = _mm_loadu_ps(py + i), pyn = _mm_loadu_ps(py + i + 1);
+		__m128 pzp = _mm_loadu_ps(pz + i - 1), pzc = _mm_loadu_ps(pz + i), pzn = _mm_loadu_ps(pz + i + 1);
+		
+		__m128 d0x = _mm_sub_ps(pxc, pxp), d1x = _mm_sub_ps(pxn, pxc);
+		__m128 d0y = _mm_sub_ps(pyc, pyp), d1y = _mm_sub_ps(pyn, pyc);
+		__m128 d0z = _mm_sub_ps(pzc, pzp), d1z = _mm_sub_ps(pzn, pzc);
+		
+		__m128 x = _mm_mul_ps(_mm_sub_ps(pxn, pxp), v_inv_2dt);
+		__m128 y = _mm_mul_ps(_mm_sub_ps(pyn, pyp), v_inv_2dt);
+		__m128 z = _mm_mul_ps(_mm_sub_ps(pzn, pzp), v_inv_2dt);
+		
+		_mm_storeu_ps(vx + i, x);
+		_mm_storeu_ps(vy + i, y);
+		_mm_storeu_ps(vz + i, z);
+		
+		_mm_storeu_ps(ax + i, _mm_mul_ps(_mm_sub_ps(d1x, d0x), v_inv_dt2));
+		_mm_storeu_ps(ay + i, _mm_mul_ps(_mm_sub_ps(d1y, d0y), v_inv_dt2));
+		_mm_storeu_ps(az + i, _mm_mul_ps(_mm_sub_ps(d1z, d0z), v_inv_dt2));
+		
+		__m128 s = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+		_mm_storeu_ps(speed + i, _mm_sqrt_ps(s));
+		
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d0x, d1x), _mm_mul_ps(d0y, d1y)), _mm_mul_ps(d0z, d1z));
+		__m128 l0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d0x, d0x), _mm_mul_ps(d0y, d0y)), _mm_mul_ps(d0z, d0z));
+		__m128 l1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d1x, d1x), _mm_mul_ps(d1y, d1y)), _mm_mul_ps(d1z, d1z));
+		__m128 len = _mm_sqrt_ps(_mm_mul_ps(l0, l1));
+		
+		__m128 moving = _mm_cmpgt_ps(len, zero);
+		__m128 c = _mm_div_ps(dot, _mm_or_ps(_mm_and_ps(moving, len), _mm_andnot_ps(moving, one)));
+		_mm_storeu_ps(turning + i, _mm_or_ps(_mm_and_ps(moving, c), _mm_andnot_ps(moving, one)));
+	}
+#endif
+	
+	for (; i < num_frames - 1; i++)
+		computeFrame(px, py, pz, i, inv_2dt, inv_dt2, vx, vy, vz, ax, ay, az, speed, turning);
+	
+	// the cosines become angles here, there is no sse acos
+	for (i = 1; i < num_frames - 1; i++)
+		turning[i] = acosf(ofClamp(turning[i], -1, 1)) * RAD_TO_DEG;
+	
+	// the end frames repeat their neighbours
+	const int last = num_frames - 1;
+	
+	vx[0] = vx[1]; vy[0] = vy[1]; vz[0] = vz[1];
+	ax[0] = ax[1]; ay[0] = ay[1]; az[0] = az[1];
+	speed[0] = speed[1];
+	turning[0] = turning[1];
+	
+	vx[last] = vx[last - 1]; vy[last] = vy[last - 1]; vz[last] = vz[last - 1];
+	ax[last] = ax[last - 1]; ay[last] = ay[last - 1]; az[last] = az[last - 1];
+	speed[last] = speed[last - 1];
+	turning[last] = turning[last - 1];
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "ofxBvh.h"
+
+// global joint positions for every frame of a take, stored per joint and
+// per axis (one column of num_frames values each), plus velocity,
+// acceleration, speed and turning angle derived from them in one pass.
+// effects can look features up for any frame, sampled or not.
+//
+//	features.build(bvh);
+//	float s = features.getSpeed(joint->getIndex(), bvh.getFrame());
+
+class ofxBvhMotionFeatures
+{
+public:
+	
+	ofxBvhMotionFeatures() : num_frames(0), num_joints(0), column_size(0), frame_time(0) {}
+	
+	// evaluates every frame of a loaded take, the bvh keeps its pose
+	void build(ofxBvh& bvh);
+	void clear();
+	
+	int getNumFrames() const { return num_frames; }
+	int getNumJoints() const { return num_joints; }
+	float getFrameTime() const { return frame_time; }
+	
+	// num_frames values, 16 byte aligned
+	const float* getPositionColumn(int joint, int axis) const { return column(POSITION, joint, axis); }
+	const float* getVelocityColumn(int joint, int axis) const { return column(VELOCITY, joint, axis); }
+	const float* getAccelerationColumn(int joint, int axis) const { return column(ACCELERATION, joint, axis); }
+	const float* getSpeedColumn(int joint) const { return column(SPEED, joint, 0); }
+	const float* getTurningColumn(int joint) const { return column(TURNING, joint, 0); }
+	
+	ofVec3f getPosition(int joint, int frame) const { return vector3(POSITION, joint, frame); }
+	
+	// per second, from central differences
+	ofVec3f getVelocity(int joint, int frame) const { return vector3(VELOCITY, joint, frame); }
+	ofVec3f getAcceleration(int joint, int frame) const { return vector3(ACCELERATION, joint, frame); }
+	float getSpeed(int joint, int frame) const { return column(SPEED, joint, 0)[frame]; }
+	
+	// degrees between the steps into and out of a frame
+	float getTurningAngle(int joint, int frame) const { return column(TURNING, joint, 0)[frame]; }
+	
+protected:
+	
+	enum Feature
+	{
+		POSITION, VELOCITY, ACCELERATION, SPEED, TURNING
+	};
+	
+	int num_frames;
+	int num_joints;
+	int column_size;	// num_frames padded to a multiple of 4
+	float frame_time;
+	
+	typedef vector<float, ofxBvhAlignedAllocator<float> > Columns;
+	
+	// positions, velocities and accelerations have 3 columns per joint,
+	// speed and turning one
+	Columns positions;
+	Columns velocities;
+	Columns accelerations;
+	Columns speeds;
+	Columns turnings;
+	
+	const float* column(Feature feature, int joint, int axis) const;
+	
+	inline float* column(Feature feature, int joint, int axis)
+	{
+		return const_cast<float*>(static_cast<const ofxBvhMotionFeatures*>(this)->column(feature, joint, axis));
+	}
+	
+	inline ofVec3f vector3(Feature feature, int joint, int frame) const
+	{
+		return ofVec3f(column(feature, joint, 0)[frame],
+					   column(feature, joint, 1)[frame],
+					   column(feature, joint, 2)[frame]);
+	}
+	
+	void computeDerivatives(int joint);
+};
@@ -0,0 +1,143 @@
+#include "ofxBvhPlayer.h"
+
+bool ofxBvhPlayer::setup(ofPtr<const ofxBvh> take)
+{
+	this->take.reset();
+	frame_time = duration = 0;
+	
+	if (!take)
+	{
+		ofLogError("ofxBvh", "player needs a take");
+		return false;
+	}
+	
+	// a loader would still be writing the frames the players read
+	if (take->loader || take->load_job)
+	{
+		ofLogError("ofxBvh", "player needs a take that is done loading");
+		return false;
+	}
+	
+	if (!take->getSkeleton() || take->num_loaded_frames == 0)
+	{
+		ofLogError("ofxBvh", "player needs a loaded take");
+		return false;
+	}
+	
+	this->take = take;
+	pose.allocate(*take);
+	
+	frame_time = take->frame_time;
+	duration = take->num_loaded_frames * frame_time;
+	
+	setTime(time);
+	need_update = true;
+	
+	return true;
+}
+
+void ofxBvhPlayer::update()
+{
+	advance(ofGetFrameNum() > 1 ? ofGetLastFrameTime() : 0);
+}
+
+void ofxBvhPlayer::advance(float dt)
+{
+	frame_new = false;
+	
+	if (!take) return;
+	
+	if (clock)
+	{
+		setTime(clock->getTime());
+	}
+	else if (playing)
+	{
+		const float duration = getDuration();
+		float t = time + dt * rate;
+		
+		if (!loop && (t < 0 || t > duration))
+			playing = false;
+		
+		setTime(t);
+	}
+	
+	if (!need_update) return;
+	
+	need_update = false;
+	frame_new = take->evaluate(time, loop, pose);
+}
+
+void ofxBvhPlayer::draw()
+{
+	if (!take) return;
+	
+	// the shape of each joint comes from the skeleton, not from the
+	// take's joints
+	const vector<int> &parents = take->getSkeleton()->getParents();
+	vector<int> num_children(parents.size(), 0);
+	
+	for (int i = 0; i < parents.size(); i++)
+		if (parents[i] >= 0) num_children[parents[i]]++;
+	
+	ofPushStyle();
+	ofFill();
+	
+	for (int i = 0; i < pose.getNumJoints(); i++)
+		ofxBvh::drawJoint(parents[i] < 0, num_children[i], pose.getGlobalMatrix(i));
+	
+	ofPopStyle();
+}
+
+void ofxBvhPlayer::setLoop(bool yn)
+{
+	loop = yn;
+	need_update = true;
+}
+
+void ofxBvhPlayer::setTime(float seconds)
+{
+	const float duration = getDuration();
+	
+	if (loop && duration > 0)
+	{
+		seconds = fmodf(seconds, duration);
+		if (seconds < 0) seconds += duration;
+	}
+	else
+	{
+		seconds = ofClamp(seconds, 0, duration);
+	}
+	
+	if (seconds != time)
+	{
+		time = seconds;
+		need_update = true;
+	}
+}
+
+void ofxBvhPlayer::setFrame(int index)
+{
+	setTime(index * frame_time);
+}
+
+int ofxBvhPlayer::getFrame() const
+{
+	return frame_time > 0 ? floor(time / frame_time) : 0;
+}
+
+void ofxBvhPlayer::setPosition(float pos)
+{
+	setTime(getDuration() * pos);
+}
+
+float ofxBvhPlayer::getPosition() const
+{
+	const float duration = getDuration();
+	return duration > 0 ? time / duration : 0;
+}
+
+size_t ofxBvhPlayer::getMemoryUsage() const
+{
+	return sizeof(ofxBvhPlayer) - sizeof(ofxBvhPoseBuffer) + pose.getMemoryUsage();
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "ofxBvh.h"
+
+// plays a take without copying it. the take is shared by reference count
+// and only read through its const interface, a player is a time cursor and
+// a pose, so one take can run on hundreds of players at different offsets
+// for the memory of a pose each. poses are sampled between frames like
+// ofxBvh::evaluate().
+//
+//	ofPtr<ofxBvh> take(new ofxBvh);
+//	take->load("aachan.bvh");
+//
+//	vector<ofxBvhPlayer> crowd(500);
+//	for (int i = 0; i < crowd.size(); i++)
+//	{
+//		crowd[i].setup(take);
+//		crowd[i].setTime(ofRandom(take->getDuration()));
+//		crowd[i].setLoop(true);
+//		crowd[i].play();
+//	}
+//
+// the take has to be done loading. don't load, compress or change the
+// rotation cache of it while players are set up on it.
+
+class ofxBvhPlayer
+{
+public:
+	
+	ofxBvhPlayer() : frame_time(0), duration(0), time(0), rate(1), loop(false), playing(false),
+		clock(NULL), frame_new(false), need_update(false) {}
+	
+	// fails for a take that is still loading, see ofxBvh::waitForLoad()
+	bool setup(ofPtr<const ofxBvh> take);
+	ofPtr<const ofxBvh> getTake() const { return take; }
+	
+	void update();
+	void draw();
+	
+	// update() by an explicit time step, see ofxBvh::advance()
+	void advance(float dt);
+	
+	bool isFrameNew() const { return frame_new; }
+	
+	void play() { playing = true; }
+	void stop() { playing = false; }
+	bool isPlaying() const { return playing; }
+	
+	void setLoop(bool yn);
+	bool isLoop() const { return loop; }
+	
+	void setRate(float rate) { this->rate = rate; }
+	float getRate() const { return rate; }
+	
+	void setTime(float seconds);
+	float getTime() const { return time; }
+	
+	// see ofxBvh::setClock()
+	void setClock(ofxBvhClock *clock) { this->clock = clock; }
+	ofxBvhClock* getClock() const { return clock; }
+	
+	void setFrame(int index);
+	int getFrame() const;
+	
+	void setPosition(float pos);
+	float getPosition() const;
+	
+	float getDuration() const { return duration; }
+	
+	// the pose of the last update()
+	const ofxBvhPoseBuffer& getPose() const { return pose; }
+	
+	const ofVec3f& getJointPosition(int joint) const { return pose.getPosition(joint); }
+	const ofQuaternion& getJointRotate(int joint) const { return pose.getRotate(joint); }
+	
+	// what the player adds on top of the shared take
+	size_t getMemoryUsage() const;
+	
+protected:
+	
+	ofPtr<const ofxBvh> take;
+	ofxBvhPoseBuffer pose;
+	
+	// of the take, read once in setup()
+	float frame_time;
+	float duration;
+	
+	float time;
+	float rate;
+	bool loop;
+	bool playing;
+	ofxBvhClock *clock;
+	
+	bool frame_new;
+	bool need_update;
+};
@@ -0,0 +1,311 @@
+#include "ofxBvhPoseBatch.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define OFX_BVH_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+#if defined(OFX_BVH_USE_SSE) && defined(__AVX__)
+#define OFX_BVH_USE_AVX
+#include <immintrin.h>
+#endif
+
+// the lanes the kernel runs on, one pose each. every variant maps an
+// operation to a single ieee operation per lane.
+
+struct ScalarLanes
+{
+	typedef float Type;
+	enum { WIDTH = 1 };
+	
+	static inline Type load(const float *p) { return *p; }
+	static inline void store(float *p, Type v) { *p = v; }
+	static inline Type set(float v) { return v; }
+	static inline Type add(Type a, Type b) { return a + b; }
+	static inline Type sub(Type a, Type b) { return a - b; }
+	static inline Type mul(Type a, Type b) { return a * b; }
+	static inline Type div(Type a, Type b) { return a / b; }
+};
+
+#ifdef OFX_BVH_USE_SSE
+struct SseLanes
+{
+	typedef __m128 Type;
+	enum { WIDTH = 4 };
+	
+	static inline Type load(const float *p) { return _mm_load_ps(p); }
+	static inline void store(float *p, Type v) { _mm_store_ps(p, v); }
+	static inline Type set(float v) { return _mm_set1_ps(v); }
+	static inline Type add(Type a, Type b) { return _mm_add_ps(a, b); }
+	static inline Type sub(Type a, Type b) { return _mm_sub_ps(a, b); }
+	static inline Type mul(Type a, Type b) { return _mm_mul_ps(a, b); }
+	static inline Type div(Type a, Type b) { return _mm_div_ps(a, b); }
+};
+#endif
+
+#ifdef OFX_BVH_USE_AVX
+struct AvxLanes
+{
+	typedef __m256 Type;
+	enum { WIDTH = 8 };
+	
+	static inline Type load(const float *p) { return _mm256_load_ps(p); }
+	static inline void store(float *p, Type v) { _mm256_store_ps(p, v); }
+	static inline Type set(float v) { return _mm256_set1_ps(v); }
+	static inline Type add(Type a, Type b) { return _mm256_add_ps(a, b); }
+	static inline Type sub(Type a, Type b) { return _mm256_sub_ps(a, b); }
+	static inline Type mul(Type a, Type b) { return _mm256_mul_ps(a, b); }
+	static inline Type div(Type a, Type b) { return _mm256_div_ps(a, b); }
+};
+#endif
+
+// local transform from translation and quaternion (same terms as
+// ofMatrix4x4::setRotate), then global = local * parent global. the
+// pointers are at the first pose of the step, columns are stride apart.
+template <class L>
+static inline void solveJoint(const float *local, size_t local_stride,
+							  const float *parent, float *global, size_t stride)
+{
+	typedef typename L::Type V;
+	
+	const V tx = L::load(local), ty = L::load(local + local_stride), tz = L::load(local + local_stride * 2);
+	const V qx = L::load(local + local_stride * 3), qy = L::load(local + local_stride * 4);
+	const V qz = L::load(local + local_stride * 5), qw = L::load(local + local_stride * 6);
+	
+	const V n = L::add(L::add(L::add(L::mul(qx, qx), L::mul(qy, qy)), L::mul(qz, qz)), L::mul(qw, qw));
+	const V s = L::div(L::set(2), n);
+	
+	const V x2 = L::mul(qx, s), y2 = L::mul(qy, s), z2 = L::mul(qz, s);
+	const V xx = L::mul(qx, x2), xy = L::mul(qx, y2), xz = L::mul(qx, z2);
+	const V yy = L::mul(qy, y2), yz = L::mul(qy, z2), zz = L::mul(qz, z2);
+	const V wx = L::mul(qw, x2), wy = L::mul(qw, y2), wz = L::mul(qw, z2);
+	
+	const V one = L::set(1);
+	
+	const V r[9] = {
+		L::sub(one, L::add(yy, zz)), L::add(xy, wz), L::sub(xz, wy),
+		L::sub(xy, wz), L::sub(one, L::add(xx, zz)), L::add(yz, wx),
+		L::add(xz, wy), L::sub(yz, wx), L::sub(one, L::add(xx, yy))
+	};
+	
+	if (!parent)
+	{
+		for (int i = 0; i < 9; i++)
+			L::store(global + stride * i, r[i]);
+		
+		L::store(global + stride * ofxBvhPoseBatch::TX, tx);
+		L::store(global + stride * ofxBvhPoseBatch::TY, ty);
+		L::store(global + stride * ofxBvhPoseBatch::TZ, tz);
+		return;
+	}
+	
+	V p[12];
+	for (int i = 0; i < 12; i++)
+		p[i] = L::load(parent + stride * i);
+	
+	for (int row = 0; row < 3; row++)
+	{
+		for (int col = 0; col < 3; col++)
+		{
+			const V v = L::add(L::add(L::mul(r[row * 3], p[col]), L::mul(r[row * 3 + 1], p[3 + col])),
+							   L::mul(r[row * 3 + 2], p[6 + col]));
+			L::store(global + stride * (row * 3 + col), v);
+		}
+	}
+	
+	for (int col = 0; col < 3; col++)
+	{
+		const V v = L::add(L::add(L::add(L::mul(tx, p[col]), L::mul(ty, p[3 + col])),
+								  L::mul(tz, p[6 + col])), p[9 + col]);
+		L::store(global + stride * (ofxBvhPoseBatch::TX + col), v);
+	}
+}
+
+template <class L>
+static void solvePoses(const int *parents, int num_joints, const float *locals, float *globals,
+					   size_t column_size, int num_locals, int num_components)
+{
+	const size_t local_stride = column_size;
+	
+	for (size_t i = 0; i < column_size; i += L::WIDTH)
+	{
+		for (int j = 0; j < num_joints; j++)
+		{
+			const float *parent = parents[j] >= 0
+				? globals + (size_t)parents[j] * num_components * column_size + i
+				: NULL;
+			
+			solveJoint<L>(locals + (size_t)j * num_locals * column_size + i, local_stride,
+						  parent, globals + (size_t)j * num_components * column_size + i, column_size);
+		}
+	}
+}
+
+bool ofxBvhPoseBatch::evaluate(ofxBvh& bvh, int first_frame, int num_frames)
+{
+	bvh.waitForLoad();
+	
+	if (first_frame < 0 || num_frames < 0 || first_frame + num_frames > bvh.getNumFrames())
+	{
+		ofLogError("ofxBvh", "frames out of range: " + ofToString(first_frame) + " + " + ofToString(num_frames));
+		return false;
+	}
+	
+	if (!prepare(bvh.getSkeleton(), num_frames))
+		return false;
+	
+	for (int i = 0; i < num_frames; i++)
+		gather(bvh, first_frame + i, i);
+	
+	solve();
+	return true;
+}
+
+bool ofxBvhPoseBatch::evaluate(const vector<ofxBvh*>& takes)
+{
+	if (takes.empty())
+	{
+		clear();
+		return true;
+	}
+	
+	for (int i = 0; i < takes.size(); i++)
+	{
+		takes[i]->waitForLoad();
+		
+		if (takes[i]->getSkeleton() != takes[0]->getSkeleton() || takes[i]->getNumFrames() == 0)
+		{
+			ofLogError("ofxBvh", "batch takes need frames and one shared skeleton");
+			return false;
+		}
+	}
+	
+	if (!prepare(takes[0]->getSkeleton(), takes.size()))
+		return false;
+	
+	for (int i = 0; i < takes.size(); i++)
+		gather(*takes[i], std::max(0, takes[i]->current_index), i);
+	
+	solve();
+	return true;
+}
+
+void ofxBvhPoseBatch::clear()
+{
+	num_poses = 0;
+	num_joints = 0;
+	column_size = 0;
+	
+	skeleton.reset();
+	
+	locals.clear();
+	globals.clear();
+}
+
+ofVec3f ofxBvhPoseBatch::getPosition(int pose, int joint) const
+{
+	return ofVec3f(globals[column(joint, TX) + pose],
+				   globals[column(joint, TY) + pose],
+				   globals[column(joint, TZ) + pose]);
+}
+
+ofMatrix4x4 ofxBvhPoseBatch::getGlobalMatrix(int pose, int joint) const
+{
+	ofMatrix4x4 m;
+	
+	for (int row = 0; row < 3; row++)
+		for (int col = 0; col < 3; col++)
+			m(row, col) = globals[column(joint, row * 3 + col) + pose];
+	
+	m(3, 0) = globals[column(joint, TX) + pose];
+	m(3, 1) = globals[column(joint, TY) + pose];
+	m(3, 2) = globals[column(joint, TZ) + pose];
+	
+	return m;
+}
+
+int ofxBvhPoseBatch::getSimdWidth()
+{
+#if defined(OFX_BVH_USE_AVX)
+	return 8;
+#elif defined(OFX_BVH_USE_SSE)
+	return 4;
+#else
+	return 1;
+#endif
+}
+
+bool ofxBvhPoseBatch::prepare(const ofPtr<const ofxBvhSkeleton>& skeleton, int num_poses)
+{
+	clear();
+	
+	if (!skeleton)
+	{
+		ofLogError("ofxBvh", "batch needs a loaded take");
+		return false;
+	}
+	
+	this->skeleton = skeleton;
+	this->num_poses = num_poses;
+	num_joints = skeleton->getNumJoints();
+	column_size = (num_poses + 7) & ~7;
+	
+	locals.assign((size_t)num_joints * NUM_LOCALS * column_size, 0);
+	globals.assign((size_t)num_joints * NUM_COMPONENTS * column_size, 0);
+	
+	// padding poses get an identity rotation rather than a zero quaternion
+	for (int j = 0; j < num_joints; j++)
+	{
+		float *qw = &locals[(size_t)(j * NUM_LOCALS + 6) * column_size];
+		std::fill(qw, qw + column_size, 1.0f);
+	}
+	
+	return true;
+}
+
+void ofxBvhPoseBatch::gather(ofxBvh& bvh, int frame, int pose)
+{
+	const float *frame_data = bvh.getPoseFrame(frame);
+	const ofQuaternion *rotations = bvh.getPoseRotations(frame, frame_data);
+	
+	for (int j = 0; j < num_joints; j++)
+	{
+		const int slot = bvh.rotation_slots[j];
+		
+		const ofVec3f t = bvh.getTranslation(frame_data, j);
+		const ofQuaternion q = rotations && slot >= 0 ? rotations[slot] : bvh.getRotation(frame_data, j);
+		
+		float *dst = &locals[(size_t)j * NUM_LOCALS * column_size + pose];
+		
+		dst[0] = t.x;
+		dst[column_size] = t.y;
+		dst[column_size * 2] = t.z;
+		dst[column_size * 3] = q.x();
+		dst[column_size * 4] = q.y();
+		dst[column_size * 5] = q.z();
+		dst[column_size * 6] = q.w();
+	}
+}
+
+void ofxBvhPoseBatch::solve()
+{
+	if (num_poses == 0) return;
+	
+	const int *parents = &skeleton->getParents()[0];
+
+#if defined(OFX_BVH_USE_AVX)
+	if (use_simd)
+	{
+		solvePoses<AvxLanes>(parents, num_joints, &locals[0], &globals[0], column_size, NUM_LOCALS, NUM_COMPONENTS);
+		return;
+	}
+#elif defined(OFX_BVH_USE_SSE)
+	if (use_simd)
+	{
+		solvePoses<SseLanes>(parents, num_joints, &locals[0], &globals[0], column_size, NUM_LOCALS, NUM_COMPONENTS);
+		return;
+	}
+#endif
+	
+	solvePoses<ScalarLanes>(parents, num_joints, &locals[0], &globals[0], column_size, NUM_LOCALS, NUM_COMPONENTS);
+}
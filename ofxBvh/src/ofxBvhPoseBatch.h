@@ -0,0 +1,79 @@
+#pragma once
+
+#include "ofxBvh.h"
+
+// global joint transforms for many poses at once, a run of frames of one
+// take or the current frames of several takes sharing a skeleton. poses
+// are evaluated 4 (sse) or 8 (avx) at a time and stored per joint and per
+// component, one column of poses each. the scalar path does the same
+// operations in the same order, so both give the same bits.
+//
+//	batch.evaluate(bvh, 0, bvh.getNumFrames());
+//	ofVec3f p = batch.getPosition(frame, joint->getIndex());
+
+class ofxBvhPoseBatch
+{
+public:
+	
+	// rotation rows followed by the translation
+	enum Component
+	{
+		R00, R01, R02,
+		R10, R11, R12,
+		R20, R21, R22,
+		TX, TY, TZ,
+		NUM_COMPONENTS
+	};
+	
+	ofxBvhPoseBatch() : num_poses(0), num_joints(0), column_size(0), use_simd(true) {}
+	
+	// frames [first_frame, first_frame + num_frames) of a loaded take, the
+	// bvh keeps its pose
+	bool evaluate(ofxBvh& bvh, int first_frame, int num_frames);
+	
+	// one pose per take, at its current frame
+	bool evaluate(const vector<ofxBvh*>& takes);
+	
+	void clear();
+	
+	int getNumPoses() const { return num_poses; }
+	int getNumJoints() const { return num_joints; }
+	
+	// num_poses values, aligned for the widest vector used
+	const float* getColumn(int joint, Component component) const { return &globals[column(joint, component)]; }
+	
+	ofVec3f getPosition(int pose, int joint) const;
+	ofMatrix4x4 getGlobalMatrix(int pose, int joint) const;
+	
+	// off forces the scalar path, for comparison
+	void setUseSimd(bool yn) { use_simd = yn; }
+	bool getUseSimd() const { return use_simd; }
+	
+	// poses per step of the vector path, 1 without sse
+	static int getSimdWidth();
+	
+protected:
+	
+	enum { NUM_LOCALS = 7 };	// tx ty tz qx qy qz qw
+	
+	int num_poses;
+	int num_joints;
+	int column_size;	// num_poses padded to a multiple of 8
+	bool use_simd;
+	
+	ofPtr<const ofxBvhSkeleton> skeleton;
+	
+	typedef vector<float, ofxBvhAlignedAllocator<float, 32> > Columns;
+	
+	Columns locals;
+	Columns globals;
+	
+	inline size_t column(int joint, int component) const
+	{
+		return (size_t)(joint * NUM_COMPONENTS + component) * column_size;
+	}
+	
+	bool prepare(const ofPtr<const ofxBvhSkeleton>& skeleton, int num_poses);
+	void gather(ofxBvh& bvh, int frame, int pose);
+	void solve();
+};
@@ -0,0 +1,163 @@
+#include "ofxBvhStepper.h"
+
+void ofxBvhStepper::setup(float step_size)
+{
+	if (step_size <= 0)
+	{
+		ofLogError("ofxBvh", "step size must be positive: " + ofToString(step_size));
+		return;
+	}
+	
+	this->step_size = step_size;
+	
+	origin = time;
+	count = 0;
+	pending = 0;
+}
+
+void ofxBvhStepper::add(ofxBvh& bvh)
+{
+	takes.push_back(&bvh);
+}
+
+void ofxBvhStepper::add(ofxBvhGroup& group)
+{
+	groups.push_back(&group);
+}
+
+void ofxBvhStepper::add(ofxBvhPlayer& player)
+{
+	players.push_back(&player);
+}
+
+void ofxBvhStepper::addListener(Listener *listener)
+{
+	if (listener)
+		listeners.push_back(listener);
+}
+
+void ofxBvhStepper::clear()
+{
+	takes.clear();
+	groups.clear();
+	players.clear();
+	listeners.clear();
+}
+
+int ofxBvhStepper::update(float dt)
+{
+	pending += dt;
+	
+	int n = floor(pending / step_size);
+	
+	if (n > max_steps)
+	{
+		n = max_steps;
+		pending = 0;
+	}
+	else
+	{
+		pending -= n * (double)step_size;
+	}
+	
+	for (int i = 0; i < n; i++)
+		step();
+	
+	return n;
+}
+
+int ofxBvhStepper::updateTo(float target)
+{
+	const double ahead = target - time;
+	
+	if (ahead < -step_size || ahead > max_steps * (double)step_size)
+	{
+		seek(target);
+		return 0;
+	}
+	
+	int n = 0;
+	
+	for (; canStep(target); n++)
+		step();
+	
+	return n;
+}
+
+int ofxBvhStepper::run(float target)
+{
+	int n = 0;
+	
+	for (; canStep(target); n++)
+		step();
+	
+	return n;
+}
+
+void ofxBvhStepper::reset()
+{
+	seek(0);
+	num_steps = 0;
+}
+
+void ofxBvhStepper::step()
+{
+	time = origin + ++count * (double)step_size;
+	num_steps++;
+	
+	for (int i = 0; i < takes.size(); i++)
+		takes[i]->advance(step_size);
+	
+	for (int i = 0; i < groups.size(); i++)
+		groups[i]->advance(step_size);
+	
+	for (int i = 0; i < players.size(); i++)
+		players[i]->advance(step_size);
+	
+	for (int i = 0; i < listeners.size(); i++)
+		listeners[i]->step(time, step_size);
+}
+
+bool ofxBvhStepper::canStep(float target) const
+{
+	return origin + (count + 1) * (double)step_size <= target + step_size * 1e-3;
+}
+
+void ofxBvhStepper::seek(float t)
+{
+	origin = time = t;
+	count = 0;
+	pending = 0;
+	
+	for (int i = 0; i < takes.size(); i++)
+		seek(*takes[i], t);
+	
+	for (int i = 0; i < groups.size(); i++)
+	{
+		ofxBvhGroup &group = *groups[i];
+		
+		for (int j = 0; j < group.size(); j++)
+			seek(group[j], t);
+	}
+	
+	for (int i = 0; i < players.size(); i++)
+		players[i]->setTime(t);
+}
+
+void ofxBvhStepper::seek(ofxBvh& bvh, float t)
+{
+	const float duration = bvh.getDuration();
+	if (duration <= 0) return;
+	
+	if (bvh.isLoop())
+	{
+		t = fmodf(t, duration);
+		if (t < 0) t += duration;
+	}
+	
+	// the play head lands on t itself, not on the start of its frame, so
+	// the following steps cross frames where a continuous run would
+	t = ofClamp(t, 0, duration);
+	bvh.setFrame(ofClamp(floor(t / bvh.frame_time), 0, bvh.getNumFrames() - 1));
+	bvh.play_head = t;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "ofxBvh.h"
+#include "ofxBvhGroup.h"
+#include "ofxBvhPlayer.h"
+
+// advances takes and a simulation in fixed steps of motion time, so the
+// result doesn't depend on the frame rate. in an app, update() runs as
+// many steps as the elapsed time covers; run() steps a whole piece
+// without a window as fast as the CPU goes. the same steps give the same
+// results either way.
+//
+//	stepper.setup(1 / 60.);
+//	stepper.add(bvh);
+//	stepper.addListener(this);	// step(float time, float dt) per step
+//	...
+//	stepper.update(ofGetLastFrameTime());	// in testApp::update()
+//	stepper.run(64.28);					// offline
+
+class ofxBvhStepper
+{
+public:
+	
+	class Listener
+	{
+	public:
+		
+		virtual ~Listener() {}
+		
+		// after the takes have been advanced to time
+		virtual void step(float time, float dt) = 0;
+	};
+	
+	ofxBvhStepper() : step_size(1 / 60.), max_steps(8), origin(0), count(0), time(0), pending(0), num_steps(0) {}
+	
+	void setup(float step_size);
+	float getStepSize() const { return step_size; }
+	
+	// advanced by every step, they must stay where they are
+	void add(ofxBvh& bvh);
+	void add(ofxBvhGroup& group);
+	void add(ofxBvhPlayer& player);
+	void addListener(Listener *listener);
+	void clear();
+	
+	// runs the steps dt covers, at most max_steps; the rest is dropped so
+	// a stalled app doesn't spiral. returns the steps run.
+	int update(float dt);
+	
+	// steps until the given time. a time behind the stepper, or more than
+	// max_steps ahead, seeks the takes there instead.
+	int updateTo(float time);
+	
+	// steps until time with no limit, for offline use
+	int run(float time);
+	
+	// seconds of motion already stepped
+	float getTime() const { return time; }
+	int getNumSteps() const { return num_steps; }
+	
+	void setMaxSteps(int num) { max_steps = num; }
+	int getMaxSteps() const { return max_steps; }
+	
+	// back to time 0 with every take on its first frame
+	void reset();
+	
+protected:
+	
+	float step_size;
+	int max_steps;
+	
+	// time is counted in steps from the last seek, so it doesn't drift
+	double origin;
+	int count;
+	double time;
+	double pending;
+	int num_steps;
+	
+	vector<ofxBvh*> takes;
+	vector<ofxBvhGroup*> groups;
+	vector<ofxBvhPlayer*> players;
+	vector<Listener*> listeners;
+	
+	void step();
+	bool canStep(float target) const;
+	void seek(float time);
+	static void seek(ofxBvh& bvh, float time);
+};
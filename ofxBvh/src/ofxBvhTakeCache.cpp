@@ -0,0 +1,158 @@
+#include "ofxBvhTakeCache.h"
+
+void ofxBvhTakeCache::setBudget(size_t bytes)
+{
+	budget = bytes;
+	evict("");
+}
+
+ofPtr<ofxBvh> ofxBvhTakeCache::get(string path)
+{
+	const string key = ofToDataPath(path);
+	
+	update();
+	
+	map<string, Take>::iterator it = takes.find(key);
+	if (it != takes.end())
+	{
+		num_hits++;
+		touch(it->second);
+		return it->second.bvh;
+	}
+	
+	num_misses++;
+	
+	ofPtr<ofxBvh> bvh;
+	
+	map<string, ofPtr<ofxBvh> >::iterator p = pending.find(key);
+	if (p != pending.end())
+	{
+		bvh = p->second;
+		pending.erase(p);
+		
+		bvh->waitForLoad();
+	}
+	else
+	{
+		bvh = ofPtr<ofxBvh>(new ofxBvh);
+		bvh->load(key);
+	}
+	
+	insert(key, bvh);
+	return bvh;
+}
+
+void ofxBvhTakeCache::prefetch(string path)
+{
+	const string key = ofToDataPath(path);
+	
+	if (takes.count(key) || pending.count(key))
+		return;
+	
+	ofPtr<ofxBvh> bvh(new ofxBvh);
+	bvh->loadAsync(key);
+	
+	pending[key] = bvh;
+}
+
+void ofxBvhTakeCache::update()
+{
+	map<string, ofPtr<ofxBvh> >::iterator it = pending.begin();
+	
+	while (it != pending.end())
+	{
+		if (it->second->isLoading())
+		{
+			++it;
+			continue;
+		}
+		
+		const string key = it->first;
+		ofPtr<ofxBvh> bvh = it->second;
+		
+		pending.erase(it++);
+		insert(key, bvh);
+	}
+}
+
+bool ofxBvhTakeCache::isCached(string path)
+{
+	update();
+	return takes.count(ofToDataPath(path)) > 0;
+}
+
+bool ofxBvhTakeCache::isPrefetching(string path)
+{
+	update();
+	return pending.count(ofToDataPath(path)) > 0;
+}
+
+void ofxBvhTakeCache::remove(string path)
+{
+	const string key = ofToDataPath(path);
+	
+	pending.erase(key);
+	drop(key);
+}
+
+void ofxBvhTakeCache::drop(const string& key)
+{
+	map<string, Take>::iterator it = takes.find(key);
+	if (it == takes.end()) return;
+	
+	used_bytes -= it->second.bytes;
+	lru.erase(it->second.lru);
+	takes.erase(it);
+}
+
+void ofxBvhTakeCache::clear()
+{
+	takes.clear();
+	lru.clear();
+	pending.clear();
+	
+	used_bytes = 0;
+}
+
+void ofxBvhTakeCache::resetCounters()
+{
+	num_hits = 0;
+	num_misses = 0;
+	num_evictions = 0;
+}
+
+void ofxBvhTakeCache::insert(const string& key, ofPtr<ofxBvh> bvh)
+{
+	if (bvh->getNumJoints() == 0)
+		return;
+	
+	drop(key);
+	
+	Take &take = takes[key];
+	take.bvh = bvh;
+	take.bytes = bvh->getMemoryUsage();
+	take.lru = lru.insert(lru.begin(), key);
+	
+	used_bytes += take.bytes;
+	
+	evict(key);
+}
+
+void ofxBvhTakeCache::touch(Take& take)
+{
+	lru.splice(lru.begin(), lru, take.lru);
+}
+
+void ofxBvhTakeCache::evict(const string& keep)
+{
+	while (used_bytes > budget && !lru.empty())
+	{
+		const string key = lru.back();
+		
+		// a single take over budget still stays until something replaces it
+		if (key == keep) break;
+		
+		drop(key);
+		num_evictions++;
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ofxBvh.h"
+
+// keeps decoded takes around up to a memory budget, evicting the least
+// recently used ones, and decodes upcoming takes on the shared worker pool
+//
+//	cache.prefetch("next.bvh");			// some beats ahead
+//	...
+//	ofPtr<ofxBvh> take = cache.get("next.bvh");	// no parse here
+//
+// call update() once a frame to take in finished prefetches. takes handed
+// out by get() stay valid while they are referenced, even after eviction.
+
+class ofxBvhTakeCache
+{
+public:
+	
+	ofxBvhTakeCache() : budget(256 * 1024 * 1024), used_bytes(0),
+		num_hits(0), num_misses(0), num_evictions(0) {}
+	
+	void setBudget(size_t bytes);
+	size_t getBudget() const { return budget; }
+	size_t getUsedBytes() const { return used_bytes; }
+	
+	// loads on the calling thread on a miss, waits for a pending prefetch
+	ofPtr<ofxBvh> get(string path);
+	
+	void prefetch(string path);
+	void update();
+	
+	bool isCached(string path);
+	bool isPrefetching(string path);
+	
+	void remove(string path);
+	void clear();
+	
+	int getNumTakes() const { return takes.size(); }
+	
+	// a get() served without waiting counts as a hit
+	int getNumHits() const { return num_hits; }
+	int getNumMisses() const { return num_misses; }
+	int getNumEvictions() const { return num_evictions; }
+	void resetCounters();
+	
+protected:
+	
+	struct Take
+	{
+		ofPtr<ofxBvh> bvh;
+		size_t bytes;
+		list<string>::iterator lru;
+	};
+	
+	size_t budget;
+	size_t used_bytes;
+	
+	int num_hits;
+	int num_misses;
+	int num_evictions;
+	
+	map<string, Take> takes;
+	list<string> lru;	// most recently used first
+	
+	map<string, ofPtr<ofxBvh> > pending;
+	
+	void insert(const string& key, ofPtr<ofxBvh> bvh);
+	void drop(const string& key);
+	void touch(Take& take);
+	void evict(const string& keep);
+};
@@ -0,0 +1,99 @@
+#include "ofxBvhWorkerPool.h"
+
+#include "Poco/Environment.h"
+
+class ofxBvhWorkerPool::Worker : public ofThread
+{
+public:
+	
+	Worker(ofxBvhWorkerPool *pool) : pool(pool) {}
+	
+protected:
+	
+	ofxBvhWorkerPool *pool;
+	
+	void threadedFunction()
+	{
+		while (true)
+		{
+			ofPtr<Task> task = pool->next();
+			if (!task) break;
+			
+			task->run();
+			task->done.set();
+		}
+	}
+};
+
+ofxBvhWorkerPool::ofxBvhWorkerPool(int num_threads) : pending(0, INT_MAX), stopping(false)
+{
+	if (num_threads <= 0)
+		num_threads = Poco::Environment::processorCount();
+	
+	for (int i = 0; i < num_threads; i++)
+	{
+		Worker *o = new Worker(this);
+		o->startThread(true, false);
+		workers.push_back(o);
+	}
+}
+
+ofxBvhWorkerPool::~ofxBvhWorkerPool()
+{
+	mutex.lock();
+	stopping = true;
+	mutex.unlock();
+	
+	for (int i = 0; i < workers.size(); i++)
+		pending.set();
+	
+	for (int i = 0; i < workers.size(); i++)
+	{
+		workers[i]->waitForThread(false);
+		delete workers[i];
+	}
+	
+	workers.clear();
+}
+
+ofxBvhWorkerPool& ofxBvhWorkerPool::getShared()
+{
+	static ofxBvhWorkerPool pool;
+	return pool;
+}
+
+void ofxBvhWorkerPool::start(ofPtr<Task> task)
+{
+	mutex.lock();
+	queue.push_back(task);
+	mutex.unlock();
+	
+	pending.set();
+}
+
+void ofxBvhWorkerPool::wait(const vector<ofPtr<Task> >& tasks)
+{
+	for (int i = 0; i < tasks.size(); i++)
+		tasks[i]->wait();
+}
+
+int ofxBvhWorkerPool::getNumPending()
+{
+	ofMutex::ScopedLock lock(mutex);
+	return queue.size();
+}
+
+ofPtr<ofxBvhWorkerPool::Task> ofxBvhWorkerPool::next()
+{
+	pending.wait();
+	
+	ofMutex::ScopedLock lock(mutex);
+	
+	ofPtr<Task> task;
+	if (stopping) return task;
+	
+	task = queue.front();
+	queue.pop_front();
+	
+	return task;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include "Poco/Event.h"
+#include "Poco/Semaphore.h"
+
+class ofxBvhWorkerPool
+{
+public:
+	
+	class Task
+	{
+		friend class ofxBvhWorkerPool;
+		
+	public:
+		
+		Task() : done(false) {}
+		virtual ~Task() {}
+		
+		bool isFinished() { return done.tryWait(0); }
+		void wait() { done.wait(); }
+		
+	protected:
+		
+		virtual void run() = 0;
+		
+	private:
+		
+		Poco::Event done;
+	};
+	
+	ofxBvhWorkerPool(int num_threads = 0);
+	virtual ~ofxBvhWorkerPool();
+	
+	// one thread per core, shared by everything in the addon
+	static ofxBvhWorkerPool& getShared();
+	
+	void start(ofPtr<Task> task);
+	void wait(const vector<ofPtr<Task> >& tasks);
+	
+	int getNumThreads() const { return workers.size(); }
+	int getNumPending();
+	
+protected:
+	
+	class Worker;
+	
+	vector<Worker*> workers;
+	
+	ofMutex mutex;
+	deque<ofPtr<Task> > queue;
+	Poco::Semaphore pending;
+	bool stopping;
+	
+	ofPtr<Task> next();
+};
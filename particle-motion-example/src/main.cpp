@@ -1,10 +1,192 @@
 #include "ofMain.h"
 #include "testApp.h"
 #include "ofAppGlutWindow.h"
+#include "ofxBvhPoseBatch.h"
+
+// --headless steps the whole piece without a window as fast as it goes and
+// prints a checksum of the particles, which is the same on every run
+int runHeadless()
+{
+	const float duration = 64.28;
+	
+	vector<ofxBvh> bvh(3);
+	vector<ParticleShape> particle_shapes(bvh.size());
+	
+	ofxBvhLoader loader;
+	loader.add(bvh[0], "bvhfiles/aachan.bvh");
+	loader.add(bvh[1], "bvhfiles/kashiyuka.bvh");
+	loader.add(bvh[2], "bvhfiles/nocchi.bvh");
+	loader.waitForAll();
+	
+	ofxBvhStepper stepper;
+	
+	for (int i = 0; i < bvh.size(); i++)
+	{
+		if (bvh[i].getNumFrames() == 0) return 1;
+		
+		bvh[i].setFrame(1);
+		bvh[i].play();
+		particle_shapes[i].setup(bvh[i]);
+		
+		stepper.add(bvh[i]);
+		stepper.addListener(&particle_shapes[i]);
+	}
+	
+	unsigned long long start = ofGetElapsedTimeMicros();
+	int num_steps = stepper.run(duration);
+	float elapsed = (ofGetElapsedTimeMicros() - start) * 1e-6;
+	
+	// fnv-1a over the particle positions
+	unsigned int hash = 2166136261u;
+	
+	for (int i = 0; i < particle_shapes.size(); i++)
+	{
+		const vector<Particle> &particles = particle_shapes[i].particles;
+		
+		for (int j = 0; j < particles.size(); j++)
+		{
+			const unsigned char *p = (const unsigned char*)particles[j].pos.getPtr();
+			
+			for (int k = 0; k < sizeof(float) * 3; k++)
+				hash = (hash ^ p[k]) * 16777619u;
+		}
+	}
+	
+	printf("%d steps in %.2f s, %.0f steps/s, checksum %08x\n", num_steps, elapsed, num_steps / elapsed, hash);
+	
+	return 0;
+}
+
+// bit for bit
+static bool samePose(const ofxBvhPoseBuffer& a, const ofxBvhPoseBuffer& b)
+{
+	for (int j = 0; j < a.getNumJoints(); j++)
+	{
+		if (memcmp(a.getPosition(j).getPtr(), b.getPosition(j).getPtr(), sizeof(float) * 3)
+			|| memcmp(&a.getRotate(j), &b.getRotate(j), sizeof(ofQuaternion)))
+			return false;
+	}
+	
+	return true;
+}
+
+static int countMismatches(const ofxBvhPoseBatch& a, const ofxBvhPoseBatch& b)
+{
+	int n = 0;
+	
+	for (int j = 0; j < a.getNumJoints(); j++)
+	{
+		for (int c = 0; c < ofxBvhPoseBatch::NUM_COMPONENTS; c++)
+		{
+			const float *x = a.getColumn(j, (ofxBvhPoseBatch::Component)c);
+			const float *y = b.getColumn(j, (ofxBvhPoseBatch::Component)c);
+			
+			for (int i = 0; i < a.getNumPoses(); i++)
+				if (memcmp(&x[i], &y[i], sizeof(float))) n++;
+		}
+	}
+	
+	return n;
+}
+
+// --bench times the pose paths on the three takes. evaluate() runs with and
+// without the rotation order kernels, ofxBvhPoseBatch with and without simd,
+// and each pair has to give the same bits.
+int runBench()
+{
+	const int passes = 5;
+	const char *names[] = { "aachan", "kashiyuka", "nocchi" };
+	
+	vector<ofxBvh> bvh(3);
+	
+	ofxBvhLoader loader;
+	for (int i = 0; i < bvh.size(); i++)
+		loader.add(bvh[i], "bvhfiles/" + string(names[i]) + ".bvh");
+	loader.waitForAll();
+	
+	int failures = 0;
+	
+	for (int i = 0; i < bvh.size(); i++)
+	{
+		ofxBvh &take = bvh[i];
+		
+		const int num_frames = take.getNumFrames();
+		if (num_frames == 0) return 1;
+		
+		const float frame_time = take.getDuration() / num_frames;
+		
+		ofxBvhPoseBuffer kernel_pose, generic_pose;
+		kernel_pose.allocate(take);
+		generic_pose.allocate(take);
+		
+		// on the frames themselves, so every joint is one rotation
+		double ns[2];
+		
+		for (int k = 0; k < 2; k++)
+		{
+			take.setUseKernels(k == 0);
+			
+			unsigned long long start = ofGetElapsedTimeMicros();
+			
+			for (int p = 0; p < passes; p++)
+				for (int f = 0; f < num_frames; f++)
+					take.evaluate(f * frame_time, k == 0 ? kernel_pose : generic_pose);
+			
+			ns[k] = (ofGetElapsedTimeMicros() - start) * 1e3 / ((double)passes * num_frames * take.getNumJoints());
+		}
+		
+		int pose_mismatches = 0;
+		
+		for (int f = 0; f < num_frames; f++)
+		{
+			take.setUseKernels(true);
+			take.evaluate(f * frame_time, kernel_pose);
+			take.setUseKernels(false);
+			take.evaluate(f * frame_time, generic_pose);
+			
+			if (!samePose(kernel_pose, generic_pose)) pose_mismatches++;
+		}
+		
+		take.setUseKernels(true);
+		
+		printf("%s: evaluate %.1f ns/joint with kernels, %.1f generic (%.2fx), %d frames differ\n",
+			names[i], ns[0], ns[1], ns[1] / ns[0], pose_mismatches);
+		
+		ofxBvhPoseBatch batch[2];
+		double poses_per_second[2];
+		
+		for (int k = 0; k < 2; k++)
+		{
+			batch[k].setUseSimd(k == 0);
+			
+			unsigned long long start = ofGetElapsedTimeMicros();
+			
+			for (int p = 0; p < passes; p++)
+				batch[k].evaluate(take, 0, num_frames);
+			
+			poses_per_second[k] = (double)passes * num_frames / ((ofGetElapsedTimeMicros() - start) * 1e-6);
+		}
+		
+		const int lane_mismatches = countMismatches(batch[0], batch[1]);
+		
+		printf("%s: batch %.0f poses/s simd (width %d), %.0f scalar (%.2fx), %d values differ\n",
+			names[i], poses_per_second[0], ofxBvhPoseBatch::getSimdWidth(),
+			poses_per_second[1], poses_per_second[0] / poses_per_second[1], lane_mismatches);
+		
+		if (pose_mismatches || lane_mismatches) failures++;
+	}
+	
+	return failures ? 1 : 0;
+}
 
 //========================================================================
-int main( )
+int main(int argc, char *argv[])
 {
+	if (argc > 1 && string(argv[1]) == "--headless")
+		return runHeadless();
+	
+	if (argc > 1 && string(argv[1]) == "--bench")
+		return runBench();
 
 	ofAppGlutWindow window;
 	ofSetupOpenGL(&window, 1280, 768, OF_WINDOW);
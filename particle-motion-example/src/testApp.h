@@ -2,6 +2,9 @@
 
 #include "ofMain.h"
 #include "ofxBvh.h"
+#include "ofxBvhLoader.h"
+#include "ofxBvhStepper.h"
+#include "ParticleShape.h"
 
 class testApp : public ofBaseApp
 {